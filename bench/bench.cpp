@@ -0,0 +1,415 @@
+// Benchmarks indexing, persistence and query latency on a synthetic corpus
+// whose words follow a Zipf distribution, and writes a JSON report.
+//
+//   make -C bench && bench/bench --docs 200000 --output report.json
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include "index.h"
+
+namespace {
+
+struct Config {
+    size_t documents = 200000;
+    size_t vocabulary = 50000;
+    double exponent = 1.07;
+    size_t document_length = 40;  // Mean number of words per document
+    size_t queries = 200;         // Queries per shape
+    size_t threads = 0;
+    uint64_t seed = 42;
+    std::string index_path = "bench.idx";
+    std::string output;
+};
+
+using Clock = std::chrono::steady_clock;
+
+double seconds_since(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Draws word ranks from a Zipf distribution over [0, vocabulary)
+class ZipfSampler {
+private:
+    std::vector<double> cumulative;
+
+public:
+    ZipfSampler(size_t vocabulary, double exponent) : cumulative(vocabulary) {
+        double total = 0;
+        for (size_t rank = 0; rank < vocabulary; ++rank) {
+            total += 1.0 / std::pow(rank + 1.0, exponent);
+            cumulative[rank] = total;
+        }
+        for (double& value : cumulative) {
+            value /= total;
+        }
+    }
+
+    size_t operator()(std::mt19937_64& rng) const {
+        double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+        size_t rank = std::lower_bound(cumulative.begin(), cumulative.end(), u) - cumulative.begin();
+        return std::min(rank, cumulative.size() - 1);
+    }
+};
+
+std::string word(size_t rank) {
+    return "w" + std::to_string(rank);
+}
+
+std::vector<std::vector<std::string>> generate_corpus(const Config& config) {
+    std::mt19937_64 rng(config.seed);
+    ZipfSampler sampler(config.vocabulary, config.exponent);
+    std::uniform_int_distribution<size_t> length(config.document_length / 2 + 1,
+                                                 config.document_length * 3 / 2 + 1);
+    std::vector<std::vector<std::string>> corpus(config.documents);
+    for (auto& document : corpus) {
+        size_t size = length(rng);
+        document.reserve(size);
+        for (size_t i = 0; i < size; ++i) {
+            document.push_back(word(sampler(rng)));
+        }
+    }
+    return corpus;
+}
+
+struct Latencies {
+    std::vector<double> micros;
+
+    void add(Clock::time_point start) {
+        micros.push_back(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+    }
+
+    double percentile(double p) {
+        if (micros.empty()) return 0;
+        std::sort(micros.begin(), micros.end());
+        size_t i = static_cast<size_t>(std::ceil(p / 100.0 * micros.size()));
+        return micros[std::min(micros.size() - 1, i ? i - 1 : 0)];
+    }
+
+    double mean() const {
+        double total = 0;
+        for (double m : micros) total += m;
+        return micros.empty() ? 0 : total / micros.size();
+    }
+
+    std::string to_json() {
+        std::ostringstream out;
+        out << "{\"mean_us\": " << mean() << ", \"p50_us\": " << percentile(50) << ", \"p90_us\": "
+            << percentile(90) << ", \"p99_us\": " << percentile(99) << ", \"max_us\": " << percentile(100)
+            << "}";
+        return out.str();
+    }
+};
+
+// Random queries of one shape, drawing words from rank bands so that they
+// combine frequent, medium and rare terms
+class QueryGenerator {
+private:
+    std::mt19937_64 rng;
+    size_t vocabulary;
+
+public:
+    QueryGenerator(uint64_t seed, size_t vocabulary) : rng(seed), vocabulary(vocabulary) {}
+
+    std::string frequent() { return pick(0, std::min<size_t>(vocabulary, 100)); }
+    std::string medium() { return pick(std::min<size_t>(vocabulary - 1, 100), std::min<size_t>(vocabulary, 2000)); }
+    std::string any() { return pick(0, vocabulary); }
+
+    std::string pick(size_t begin, size_t end) {
+        return word(std::uniform_int_distribution<size_t>(begin, std::max(begin, end - 1))(rng));
+    }
+
+    std::string join(const std::vector<std::string>& words, const std::string& op) {
+        std::string result = words[0];
+        for (size_t i = 1; i < words.size(); ++i) {
+            result += " " + op + " " + words[i];
+        }
+        return result;
+    }
+
+    // ((a AND b) AND c) ... nested as deep as the chain is long
+    std::string and_chain() {
+        std::string result = frequent();
+        for (int i = 0; i < 5; ++i) {
+            result = "(" + result + " AND " + (i % 2 ? medium() : frequent()) + ")";
+        }
+        return result;
+    }
+
+    std::string wide_or() {
+        std::vector<std::string> words;
+        for (int i = 0; i < 32; ++i) words.push_back(any());
+        return join(words, "OR");
+    }
+
+    std::string negation() {
+        return "NOT (" + frequent() + " OR " + medium() + ")";
+    }
+
+    std::string and_not() {
+        return "(" + frequent() + " AND " + medium() + ") AND NOT " + frequent();
+    }
+
+    std::string mixed() {
+        return "(" + frequent() + " OR " + medium() + ") AND (" + any() + " OR " + any() + ") AND NOT " + medium();
+    }
+};
+
+std::string json_string(const std::string& value) {
+    std::string result = "\"";
+    for (char c : value) {
+        if (c == '"' || c == '\\') result += '\\';
+        result += c;
+    }
+    return result + "\"";
+}
+
+size_t file_size(const std::string& path) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    return file ? static_cast<size_t>(file.tellg()) : 0;
+}
+
+void usage() {
+    std::cerr << "usage: bench [--docs N] [--vocabulary N] [--exponent S] [--length N] [--queries N]\n"
+                 "             [--threads N] [--seed N] [--index-path PATH] [--output PATH]\n";
+}
+
+Config parse_arguments(int argc, char** argv) {
+    Config config;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h") {
+            usage();
+            std::exit(0);
+        }
+        if (i + 1 >= argc) {
+            throw std::runtime_error("Missing value for " + arg);
+        }
+        std::string value = argv[++i];
+        if (arg == "--docs") config.documents = std::stoul(value);
+        else if (arg == "--vocabulary") config.vocabulary = std::stoul(value);
+        else if (arg == "--exponent") config.exponent = std::stod(value);
+        else if (arg == "--length") config.document_length = std::stoul(value);
+        else if (arg == "--queries") config.queries = std::stoul(value);
+        else if (arg == "--threads") config.threads = std::stoul(value);
+        else if (arg == "--seed") config.seed = std::stoull(value);
+        else if (arg == "--index-path") config.index_path = value;
+        else if (arg == "--output") config.output = value;
+        else throw std::runtime_error("Unknown option " + arg);
+    }
+    if (config.documents == 0 || config.vocabulary == 0 || config.document_length == 0) {
+        throw std::runtime_error("--docs, --vocabulary and --length must be positive");
+    }
+    return config;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    Config config;
+    try {
+        config = parse_arguments(argc, argv);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        usage();
+        return 2;
+    }
+
+    std::vector<std::string> sections;
+    auto section = [&](const std::string& name, const std::string& body) {
+        sections.push_back(json_string(name) + ": " + body);
+    };
+    {
+        std::ostringstream out;
+        out << "{\"documents\": " << config.documents << ", \"vocabulary\": " << config.vocabulary
+            << ", \"exponent\": " << config.exponent << ", \"document_length\": " << config.document_length
+            << ", \"queries\": " << config.queries << ", \"threads\": " << config.threads
+            << ", \"seed\": " << config.seed << "}";
+        section("config", out.str());
+    }
+
+    std::cerr << "generating " << config.documents << " documents\n";
+    auto corpus = generate_corpus(config);
+    size_t postings = 0;
+    size_t words = 0;
+    for (const auto& document : corpus) {
+        words += document.size();
+        postings += std::unordered_set<std::string>(document.begin(), document.end()).size();
+    }
+
+    Index index;
+    auto start = Clock::now();
+    for (const auto& document : corpus) {
+        index.add_document(document);
+    }
+    double add_seconds = seconds_since(start);
+
+    Index batch;
+    start = Clock::now();
+    batch.add_documents(corpus, config.threads);
+    double batch_seconds = seconds_since(start);
+
+    start = Clock::now();
+    index.save(config.index_path);
+    double save_seconds = seconds_since(start);
+    Index loaded;
+    start = Clock::now();
+    loaded.load(config.index_path);
+    double load_seconds = seconds_since(start);
+    Index mapped;
+    start = Clock::now();
+    mapped.map(config.index_path);
+    double map_seconds = seconds_since(start);
+    size_t bytes_on_disk = file_size(config.index_path);
+    std::remove(config.index_path.c_str());
+
+    size_t memory = index.memory_usage();
+    {
+        std::ostringstream out;
+        out << "{\"words\": " << words << ", \"postings\": " << postings << ", \"terms\": "
+            << index.get_terms().size() << ", \"add_document_seconds\": " << add_seconds
+            << ", \"add_document_docs_per_second\": " << config.documents / add_seconds
+            << ", \"add_documents_seconds\": " << batch_seconds
+            << ", \"add_documents_docs_per_second\": " << config.documents / batch_seconds
+            << ", \"memory_bytes\": " << memory
+            << ", \"memory_bytes_per_posting\": " << double(memory) / std::max<size_t>(postings, 1)
+            << ", \"file_bytes\": " << bytes_on_disk << ", \"save_seconds\": " << save_seconds
+            << ", \"load_seconds\": " << load_seconds << ", \"map_seconds\": " << map_seconds << "}";
+        section("build", out.str());
+    }
+    std::cerr << "indexed in " << add_seconds << "s (" << batch_seconds << "s batched), "
+              << double(memory) / std::max<size_t>(postings, 1) << " bytes per posting\n";
+
+    QueryGenerator generator(config.seed + 1, config.vocabulary);
+    std::vector<std::pair<std::string, std::function<std::string()>>> shapes = {
+        {"and_chain", [&] { return generator.and_chain(); }},
+        {"wide_or", [&] { return generator.wide_or(); }},
+        {"not", [&] { return generator.negation(); }},
+        {"and_not", [&] { return generator.and_not(); }},
+        {"mixed", [&] { return generator.mixed(); }},
+    };
+    // Keeps the results alive so that the queries are not optimized away
+    size_t checksum = 0;
+    std::vector<std::string> query_sections;
+    auto measure = [&](const std::string& name, const std::vector<QueryTree>& trees) {
+        Latencies search, count;
+        for (const auto& tree : trees) {
+            start = Clock::now();
+            checksum += index.search(tree).size();
+            search.add(start);
+            start = Clock::now();
+            checksum += index.count(tree);
+            count.add(start);
+        }
+        std::cerr << name << ": search p50 " << search.percentile(50) << "us p99 " << search.percentile(99)
+                  << "us\n";
+        query_sections.push_back(json_string(name) + ": {\"search\": " + search.to_json() +
+                                 ", \"count\": " + count.to_json() + "}");
+    };
+    for (auto& shape : shapes) {
+        std::vector<QueryTree> trees;
+        for (size_t i = 0; i < config.queries; ++i) {
+            trees.emplace_back(shape.second());
+        }
+        measure(shape.first, trees);
+    }
+
+    // Every expansion of small queries, evaluated one by one, then counted at
+    // once for a batch of candidate words through count_expansions
+    {
+        size_t num_bases = std::max<size_t>(config.queries / 10, 1);
+        std::vector<QueryTree> bases;
+        std::vector<QueryTree> expanded;
+        for (size_t i = 0; i < num_bases; ++i) {
+            bases.emplace_back("(" + generator.frequent() + " OR " + generator.medium() + ") AND NOT " +
+                               generator.medium());
+            for (auto& tree : bases.back().generateAllExpansions(generator.any())) {
+                expanded.push_back(std::move(tree));
+            }
+        }
+        measure("expansions", expanded);
+
+        std::vector<std::string> candidates;
+        for (size_t i = 0; i < 100; ++i) candidates.push_back(generator.any());
+        Latencies expansions;
+        for (const auto& tree : bases) {
+            start = Clock::now();
+            checksum += index.count_expansions(tree, candidates, config.threads).size();
+            expansions.add(start);
+        }
+        std::cerr << "count_expansions: p50 " << expansions.percentile(50) << "us\n";
+        query_sections.push_back("\"count_expansions\": {\"latency\": " + expansions.to_json() +
+                                 ", \"candidates\": " + std::to_string(candidates.size()) + "}");
+    }
+
+    // A rare term AND a wide OR, read lazily by exists() and search_page():
+    // the result cache must not make them decode the OR in full
+    {
+        std::vector<QueryTree> trees;
+        for (size_t i = 0; i < config.queries; ++i) {
+            trees.emplace_back(generator.pick(config.vocabulary / 2, config.vocabulary) + " AND (" +
+                               generator.frequent() + " OR " + generator.frequent() + " OR " +
+                               generator.frequent() + ")");
+        }
+        auto& stats = QueryStats::global();
+        stats.set_enabled(true);
+        auto lazy_scans = [&] {
+            stats.reset();
+            for (const auto& tree : trees) {
+                checksum += index.exists(tree);
+                checksum += index.search_page(tree, 10).size();
+            }
+            return stats.get().postings_scanned;
+        };
+        index.set_result_cache_size(0);
+        uint64_t uncached = lazy_scans();
+        index.set_result_cache_size(size_t(64) << 20);
+        uint64_t cached = lazy_scans();
+        index.reset_result_cache_stats();
+        measure("result_cache", trees);
+        measure("result_cache_repeated", trees);
+        auto cache = index.get_result_cache_stats();
+        index.set_result_cache_size(0);
+        stats.set_enabled(false);
+        std::cerr << "result_cache: " << uncached << " postings scanned lazily without cache, " << cached
+                  << " with, " << cache.hits << " hits " << cache.misses << " misses\n";
+        query_sections.push_back("\"result_cache_lazy\": {\"postings_scanned_uncached\": " +
+                                 std::to_string(uncached) + ", \"postings_scanned_cached\": " +
+                                 std::to_string(cached) + ", \"hits\": " + std::to_string(cache.hits) +
+                                 ", \"misses\": " + std::to_string(cache.misses) + "}");
+        if (cached != uncached) {
+            std::cerr << "result cache changed the postings scanned by lazy queries\n";
+            return 1;
+        }
+    }
+
+    std::string queries = "{";
+    for (size_t i = 0; i < query_sections.size(); ++i) {
+        queries += (i ? ", " : "") + query_sections[i];
+    }
+    section("queries", queries + "}");
+    section("checksum", std::to_string(checksum));
+
+    std::string report = "{\n";
+    for (size_t i = 0; i < sections.size(); ++i) {
+        report += "  " + sections[i] + (i + 1 < sections.size() ? ",\n" : "\n");
+    }
+    report += "}\n";
+    if (config.output.empty()) {
+        std::cout << report;
+    } else {
+        std::ofstream(config.output) << report;
+    }
+    return 0;
+}
@@ -7,7 +7,8 @@ ext_modules = [
         ["src/bindings.cpp"],
         include_dirs=[pybind11.get_include()],
         language="c++",
-        extra_compile_args=["-std=c++17", "-O3"],
+        extra_compile_args=["-std=c++17", "-O3", "-pthread"],
+        extra_link_args=["-pthread"],
     ),
 ]
 
@@ -18,6 +19,6 @@ setup(
     author_email="max.chbx@gmail.com",
     description="A blazing fast search engine with Python bindings written in C++",
     ext_modules=ext_modules,
-    setup_requires=["pybind11>=2.5.0"],
-    install_requires=["pybind11>=2.5.0"],
+    setup_requires=["pybind11>=2.6.0"],
+    install_requires=["pybind11>=2.6.0"],
 )
@@ -1,25 +1,256 @@
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
 #include "index.h"
+#include "segmented_index.h"
+#include "index_builder.h"
 #include "query_tree.h"
+#include "query_profile.h"
+#include "query_stats.h"
 #include <iostream>
 
 namespace py = pybind11;
 
+// Doc ids exposed through the buffer protocol, so that numpy.asarray() or
+// memoryview() see them without any per-element conversion. The ids are
+// either owned or borrowed from a mapped index file, which is then kept
+// mapped even if the index loads or maps another file.
+struct DocIds {
+    std::vector<int> owned;
+    const int* borrowed = nullptr;
+    size_t borrowed_size = 0;
+    std::shared_ptr<const MappedIndexFile> mapping;
+
+    const int* data() const { return borrowed ? borrowed : owned.data(); }
+    size_t size() const { return borrowed ? borrowed_size : owned.size(); }
+};
+
 PYBIND11_MODULE(eldarcpp, m) {
+    py::register_exception<QueryParseError>(m, "QueryParseError", PyExc_ValueError);
+
+    py::class_<Tokenizer>(m, "Tokenizer")
+        .def(py::init<bool, size_t, size_t, const std::vector<std::string>&, const std::string&>(),
+             py::arg("ignore_case") = true, py::arg("min_length") = 1, py::arg("max_length") = 0,
+             py::arg("stopwords") = std::vector<std::string>(), py::arg("extra_chars") = "")
+        .def("tokenize", py::overload_cast<std::string_view>(&Tokenizer::tokenize, py::const_), py::arg("text"));
+
     py::class_<Index>(m, "Index")
-        .def(py::init<>())
+        .def(py::init<bool, bool>(), py::arg("compress") = true, py::arg("frequencies") = false)
         .def("add_document", &Index::add_document)
+        .def("add_documents", &Index::add_documents,
+             py::arg("documents"), py::arg("num_threads") = 0,
+             py::call_guard<py::gil_scoped_release>())
+        .def("add_text", [](Index& index, const std::string& text, const Tokenizer& tokenizer) {
+            index.add_text(text, tokenizer);
+        }, py::arg("text"), py::arg("tokenizer") = Tokenizer())
+        .def("add_texts", &Index::add_texts,
+             py::arg("texts"), py::arg("tokenizer") = Tokenizer(), py::arg("num_threads") = 0,
+             py::call_guard<py::gil_scoped_release>())
+        .def("add_file", [](Index& index, const std::string& path, const std::string& format,
+                            const std::string& field, const Tokenizer& tokenizer, size_t num_threads) {
+            DocumentReader::Format parsed = DocumentReader::parse_format(format);
+            py::gil_scoped_release release;
+            return index.add_file(path, parsed, field, tokenizer, num_threads);
+        }, py::arg("path"), py::arg("format") = "text", py::arg("field") = "text",
+           py::arg("tokenizer") = Tokenizer(), py::arg("num_threads") = 0)
         .def("get_postings", &Index::get_postings)
+        .def("get_postings_array", [](const Index& index, const std::string& word) {
+            DocIds ids;
+            PostingsView view = index.get_postings_view(word);
+            if (index.is_mapped() && view.num_blocks == 0) {
+                ids.mapping = index.get_mapping();
+                ids.borrowed = view.tail;
+                ids.borrowed_size = view.tail_size;
+            } else {
+                ids.owned = view.decode();
+            }
+            return ids;
+        }, py::arg("word"))
         .def("get_document_count", &Index::get_document_count)
+        .def("get_terms", &Index::get_terms)
+        .def("is_compressed", &Index::is_compressed)
+        .def("is_mapped", &Index::is_mapped)
+        .def("has_frequencies", &Index::has_frequencies)
+        .def("memory_usage", &Index::memory_usage)
+        .def("reorder", &Index::reorder,
+             py::arg("iterations") = GraphBisection::DEFAULT_ITERATIONS, py::arg("num_threads") = 0,
+             py::call_guard<py::gil_scoped_release>())
         .def("search", py::overload_cast<const QueryTree&>(&Index::search, py::const_))
         .def("search", py::overload_cast<const std::string&, bool>(&Index::search, py::const_),
              py::arg("query_string"), py::arg("ignore_case") = true)
         .def("count", py::overload_cast<const QueryTree&>(&Index::count, py::const_))
         .def("count", py::overload_cast<const std::string&, bool>(&Index::count, py::const_),
              py::arg("query_string"), py::arg("ignore_case") = true)
+        .def("search_page", py::overload_cast<const QueryTree&, size_t, size_t>(&Index::search_page, py::const_),
+             py::arg("query"), py::arg("limit"), py::arg("offset") = 0)
+        .def("search_page", py::overload_cast<const std::string&, size_t, size_t, bool>(&Index::search_page, py::const_),
+             py::arg("query_string"), py::arg("limit"), py::arg("offset") = 0, py::arg("ignore_case") = true)
+        .def("exists", py::overload_cast<const QueryTree&>(&Index::exists, py::const_))
+        .def("exists", py::overload_cast<const std::string&, bool>(&Index::exists, py::const_),
+             py::arg("query_string"), py::arg("ignore_case") = true)
+        .def("estimate_count", py::overload_cast<const QueryTree&, double>(&Index::estimate_count, py::const_),
+             py::arg("query"), py::arg("sample_fraction") = 0.01)
+        .def("estimate_count", py::overload_cast<const std::string&, double, bool>(&Index::estimate_count, py::const_),
+             py::arg("query_string"), py::arg("sample_fraction") = 0.01, py::arg("ignore_case") = true)
+        .def("count_cooccurrences",
+             py::overload_cast<const QueryTree&, const std::vector<std::string>&, size_t>(
+                 &Index::count_cooccurrences, py::const_),
+             py::arg("base_query"), py::arg("terms"), py::arg("num_threads") = 0,
+             py::call_guard<py::gil_scoped_release>())
+        .def("count_cooccurrences",
+             py::overload_cast<const std::string&, std::vector<std::string>, bool, size_t>(
+                 &Index::count_cooccurrences, py::const_),
+             py::arg("base_query"), py::arg("terms"), py::arg("ignore_case") = true, py::arg("num_threads") = 0,
+             py::call_guard<py::gil_scoped_release>())
+        .def("explain", py::overload_cast<const QueryTree&>(&Index::explain, py::const_))
+        .def("explain", py::overload_cast<const std::string&, bool>(&Index::explain, py::const_),
+             py::arg("query_string"), py::arg("ignore_case") = true)
+        .def("profile", py::overload_cast<const QueryTree&>(&Index::profile, py::const_),
+             py::call_guard<py::gil_scoped_release>())
+        .def("profile", py::overload_cast<const std::string&, bool>(&Index::profile, py::const_),
+             py::arg("query_string"), py::arg("ignore_case") = true, py::call_guard<py::gil_scoped_release>())
+        .def("search_topk", py::overload_cast<const QueryTree&, size_t>(&Index::search_topk, py::const_),
+             py::arg("query"), py::arg("k"), py::call_guard<py::gil_scoped_release>())
+        .def("search_topk", py::overload_cast<const std::string&, size_t, bool>(&Index::search_topk, py::const_),
+             py::arg("query_string"), py::arg("k"), py::arg("ignore_case") = true,
+             py::call_guard<py::gil_scoped_release>())
+        .def("search_array", [](const Index& index, const std::string& query_string, bool ignore_case) {
+            DocIds ids;
+            py::gil_scoped_release release;
+            ids.owned = index.search(query_string, ignore_case);
+            return ids;
+        }, py::arg("query_string"), py::arg("ignore_case") = true)
+        .def("search_into", [](const Index& index, const std::string& query_string, py::buffer out, bool ignore_case) {
+            py::buffer_info info = out.request(true);
+            if (info.ndim != 1 || info.itemsize != sizeof(int) || info.format.empty() ||
+                info.format.back() != 'i' || (info.size > 1 && info.strides[0] != sizeof(int))) {
+                throw std::invalid_argument("Output buffer must be a contiguous 1-D int32 buffer");
+            }
+            py::gil_scoped_release release;
+            return index.search_into(query_string, static_cast<int*>(info.ptr), info.size, ignore_case);
+        }, py::arg("query_string"), py::arg("out"), py::arg("ignore_case") = true)
+        .def("search_many", &Index::search_many,
+             py::arg("queries"), py::arg("ignore_case") = true, py::arg("num_threads") = 0,
+             py::call_guard<py::gil_scoped_release>())
+        .def("count_many", &Index::count_many,
+             py::arg("queries"), py::arg("ignore_case") = true, py::arg("num_threads") = 0,
+             py::call_guard<py::gil_scoped_release>())
+        .def("count_expansions", &Index::count_expansions,
+             py::arg("query_tree"), py::arg("candidate_words"), py::arg("num_threads") = 0,
+             py::call_guard<py::gil_scoped_release>())
+        .def("match_terms", &Index::match_terms, py::arg("pattern"), py::arg("ignore_case") = true)
+        .def("set_query_cache_size", &Index::set_query_cache_size, py::arg("size"))
+        .def("set_result_cache_size", &Index::set_result_cache_size, py::arg("bytes"))
+        .def("clear_result_cache", &Index::clear_result_cache)
+        .def("get_result_cache_stats", [](const Index& index) {
+            ResultCache::Counters counters = index.get_result_cache_stats();
+            py::dict stats;
+            stats["hits"] = counters.hits;
+            stats["misses"] = counters.misses;
+            stats["extensions"] = counters.extensions;
+            stats["evictions"] = counters.evictions;
+            stats["entries"] = counters.entries;
+            stats["bytes"] = counters.bytes;
+            stats["capacity"] = counters.capacity;
+            return stats;
+        })
+        .def("reset_result_cache_stats", &Index::reset_result_cache_stats)
         .def("save", &Index::save)
-        .def("load", &Index::load);
+        .def("load", &Index::load)
+        .def("map", &Index::map);
+
+    py::class_<IndexBuilder>(m, "IndexBuilder")
+        .def(py::init<const std::string&, size_t, bool, bool>(),
+             py::arg("filename"), py::arg("memory_budget") = IndexBuilder::DEFAULT_MEMORY_BUDGET,
+             py::arg("compress") = true, py::arg("frequencies") = false)
+        .def("add_document", &IndexBuilder::add_document)
+        .def("add_documents", &IndexBuilder::add_documents, py::call_guard<py::gil_scoped_release>())
+        .def("add_text", [](IndexBuilder& builder, const std::string& text, const Tokenizer& tokenizer) {
+            builder.add_text(text, tokenizer);
+        }, py::arg("text"), py::arg("tokenizer") = Tokenizer())
+        .def("add_file", [](IndexBuilder& builder, const std::string& path, const std::string& format,
+                            const std::string& field, const Tokenizer& tokenizer) {
+            DocumentReader::Format parsed = DocumentReader::parse_format(format);
+            py::gil_scoped_release release;
+            return builder.add_file(path, parsed, field, tokenizer);
+        }, py::arg("path"), py::arg("format") = "text", py::arg("field") = "text",
+           py::arg("tokenizer") = Tokenizer())
+        .def("finish", &IndexBuilder::finish, py::call_guard<py::gil_scoped_release>())
+        .def("get_document_count", &IndexBuilder::get_document_count)
+        .def("get_run_count", &IndexBuilder::get_run_count)
+        .def("memory_usage", &IndexBuilder::memory_usage);
+
+    py::class_<SegmentedIndex>(m, "SegmentedIndex")
+        .def(py::init<size_t, size_t, bool>(),
+             py::arg("buffer_size") = 10000, py::arg("merge_factor") = 4, py::arg("compress") = true)
+        .def("add_document", &SegmentedIndex::add_document)
+        .def("add_documents", &SegmentedIndex::add_documents,
+             py::arg("documents"), py::arg("num_threads") = 0,
+             py::call_guard<py::gil_scoped_release>())
+        .def("remove_document", &SegmentedIndex::remove_document)
+        .def("search", py::overload_cast<const QueryTree&>(&SegmentedIndex::search, py::const_))
+        .def("search", py::overload_cast<const std::string&, bool>(&SegmentedIndex::search, py::const_),
+             py::arg("query_string"), py::arg("ignore_case") = true)
+        .def("count", py::overload_cast<const QueryTree&>(&SegmentedIndex::count, py::const_))
+        .def("count", py::overload_cast<const std::string&, bool>(&SegmentedIndex::count, py::const_),
+             py::arg("query_string"), py::arg("ignore_case") = true)
+        .def("snapshot", &SegmentedIndex::snapshot)
+        .def("flush", &SegmentedIndex::flush)
+        .def("wait_for_merges", &SegmentedIndex::wait_for_merges, py::call_guard<py::gil_scoped_release>())
+        .def("compact", &SegmentedIndex::compact, py::call_guard<py::gil_scoped_release>())
+        .def("get_document_count", &SegmentedIndex::get_document_count)
+        .def("get_visible_document_count", &SegmentedIndex::get_visible_document_count)
+        .def("get_deleted_count", &SegmentedIndex::get_deleted_count)
+        .def("get_segment_count", &SegmentedIndex::get_segment_count)
+        .def("memory_usage", &SegmentedIndex::memory_usage);
+
+    py::class_<IndexSnapshot>(m, "IndexSnapshot")
+        .def("search", py::overload_cast<const QueryTree&>(&IndexSnapshot::search, py::const_),
+             py::call_guard<py::gil_scoped_release>())
+        .def("search", py::overload_cast<const std::string&, bool>(&IndexSnapshot::search, py::const_),
+             py::arg("query_string"), py::arg("ignore_case") = true, py::call_guard<py::gil_scoped_release>())
+        .def("count", py::overload_cast<const QueryTree&>(&IndexSnapshot::count, py::const_),
+             py::call_guard<py::gil_scoped_release>())
+        .def("count", py::overload_cast<const std::string&, bool>(&IndexSnapshot::count, py::const_),
+             py::arg("query_string"), py::arg("ignore_case") = true, py::call_guard<py::gil_scoped_release>())
+        .def("get_document_count", &IndexSnapshot::get_document_count)
+        .def("get_deleted_count", &IndexSnapshot::get_deleted_count)
+        .def("get_segment_count", &IndexSnapshot::get_segment_count);
+
+    py::class_<DocIds>(m, "DocIds", py::buffer_protocol())
+        .def_buffer([](DocIds& ids) {
+            return py::buffer_info(const_cast<int*>(ids.data()), sizeof(int), py::format_descriptor<int>::format(),
+                                   1, {static_cast<py::ssize_t>(ids.size())}, {sizeof(int)}, true);
+        })
+        .def("__len__", &DocIds::size);
+
+    py::class_<QueryProfile>(m, "QueryProfile")
+        .def_readonly("op", &QueryProfile::op)
+        .def_readonly("word", &QueryProfile::word)
+        .def_readonly("algorithm", &QueryProfile::algorithm)
+        .def_readonly("postings", &QueryProfile::postings)
+        .def_readonly("estimate", &QueryProfile::estimate)
+        .def_readonly("excluded", &QueryProfile::excluded)
+        .def_readonly("output", &QueryProfile::output)
+        .def_readonly("calls", &QueryProfile::calls)
+        .def_readonly("seconds", &QueryProfile::seconds)
+        .def_readonly("bytes", &QueryProfile::bytes)
+        .def_readonly("children", &QueryProfile::children)
+        .def("to_json", &QueryProfile::to_json)
+        .def("__repr__", &QueryProfile::to_json);
+
+    m.def("set_query_stats_enabled", [](bool enabled) { QueryStats::global().set_enabled(enabled); },
+          py::arg("enabled"));
+    m.def("get_query_stats", []() {
+        QueryStats::Counters counters = QueryStats::global().get();
+        py::dict stats;
+        stats["queries"] = counters.queries;
+        stats["parses"] = counters.parses;
+        stats["parse_seconds"] = counters.parse_nanos / 1e9;
+        stats["evaluate_seconds"] = counters.evaluate_nanos / 1e9;
+        stats["postings_scanned"] = counters.postings_scanned;
+        return stats;
+    });
+    m.def("reset_query_stats", []() { QueryStats::global().reset(); });
 
     py::class_<QueryTree>(m, "QueryTree")
         .def(py::init<const std::string&, bool>(), 
@@ -37,6 +268,10 @@ PYBIND11_MODULE(eldarcpp, m) {
     py::class_<WordNode, QueryNode>(m, "WordNode")
         .def("get_word", &WordNode::getWord);
 
+    py::class_<PatternNode, WordNode>(m, "PatternNode")
+        .def("prefix", [](const PatternNode& node) { return std::string(node.prefix()); })
+        .def("matches", [](const PatternNode& node, const std::string& term) { return node.matches(term); });
+
     py::class_<NotNode, QueryNode>(m, "NotNode")
         .def("get_child", &NotNode::getChild, py::return_value_policy::reference_internal);
 
@@ -0,0 +1,350 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <limits>
+#include <algorithm>
+#include "postings.h"
+#include "query_stats.h"
+
+// Document-at-a-time iterator over the sorted doc ids matching a query node.
+// A cursor starts before its first doc (doc() == -1) and reports END once
+// exhausted. advance(target) moves to the first doc >= target and never moves
+// backwards, so it returns the current doc when that already satisfies target.
+class DocCursor {
+public:
+    static constexpr int END = std::numeric_limits<int>::max();
+
+    virtual ~DocCursor() = default;
+    virtual int doc() const = 0;
+    virtual int next() = 0;
+    virtual int advance(int target) = 0;
+    // Upper bound on the number of docs the cursor yields
+    virtual size_t cost() const = 0;
+
+    // First index in [begin, end) whose value is >= target, probing
+    // exponentially growing steps from begin before a binary search
+    static size_t gallop(const int* data, size_t begin, size_t end, int target) {
+        size_t step = 1;
+        size_t low = begin;
+        size_t high = begin;
+        while (high < end && data[high] < target) {
+            low = high + 1;
+            high += step;
+            step <<= 1;
+        }
+        return std::lower_bound(data + low, data + std::min(high, end), target) - data;
+    }
+};
+
+class EmptyCursor : public DocCursor {
+public:
+    int doc() const override { return END; }
+    int next() override { return END; }
+    int advance(int) override { return END; }
+    size_t cost() const override { return 0; }
+};
+
+// Every doc id in [0, universe_size)
+class AllCursor : public DocCursor {
+private:
+    int current;
+    int universe_size;
+public:
+    explicit AllCursor(int universe_size) : current(-1), universe_size(universe_size) {}
+    int doc() const override { return current; }
+    int next() override { return advance(current + 1); }
+    int advance(int target) override {
+        if (current >= target) return current;
+        current = target < universe_size ? target : END;
+        return current;
+    }
+    size_t cost() const override { return universe_size; }
+};
+
+// Cursor over a sorted vector of doc ids
+class VectorCursor : public DocCursor {
+private:
+    std::vector<int> owned;
+    // Docs shared with a ResultCache, read instead of `owned` when set
+    std::shared_ptr<const std::vector<int>> shared;
+    const int* docs;
+    size_t size;
+    size_t pos;
+    int current;
+public:
+    explicit VectorCursor(std::vector<int> docs)
+        : owned(std::move(docs)), docs(owned.data()), size(owned.size()), pos(0), current(-1) {}
+    explicit VectorCursor(std::shared_ptr<const std::vector<int>> docs)
+        : shared(std::move(docs)), docs(shared->data()), size(shared->size()), pos(0), current(-1) {}
+    VectorCursor(const VectorCursor&) = delete;
+    VectorCursor& operator=(const VectorCursor&) = delete;
+    int doc() const override { return current; }
+    int next() override {
+        if (current != -1 && current != END) pos++;
+        current = pos < size ? docs[pos] : END;
+        return current;
+    }
+    int advance(int target) override {
+        if (current >= target) return current;
+        pos = gallop(docs, pos, size, target);
+        current = pos < size ? docs[pos] : END;
+        return current;
+    }
+    size_t cost() const override { return size; }
+};
+
+// Cursor over a postings list. Blocks are only decoded when the cursor lands
+// in them: advance() first skips whole blocks through the skip table, then
+// gallops inside the decoded block.
+class PostingsCursor : public DocCursor {
+private:
+    PostingsView postings;
+    int buffer[BlockCodec::BLOCK_SIZE];
+    size_t block;        // Current block, num_blocks() for the raw tail
+    const int* data;
+    size_t length;
+    size_t pos;
+    int current;
+    size_t scanned;      // Doc ids loaded so far, reported to QueryStats
+
+    void load(size_t b) {
+        block = b;
+        pos = 0;
+        if (b < postings.num_blocks) {
+            postings.decode_block(b, buffer);
+            data = buffer;
+            length = BlockCodec::BLOCK_SIZE;
+        } else if (b == postings.num_blocks) {
+            data = postings.tail;
+            length = postings.tail_size;
+        } else {
+            data = nullptr;
+            length = 0;
+        }
+        scanned += length;
+    }
+
+    // Last doc of a block or of the tail, -1 when there is none
+    int segment_last_doc(size_t b) const {
+        if (b < postings.num_blocks) return postings.block_last_doc(b);
+        return b == postings.num_blocks && postings.tail_size ? postings.tail[postings.tail_size - 1] : -1;
+    }
+
+public:
+    explicit PostingsCursor(const PostingsView& postings)
+        : postings(postings), block(0), data(nullptr), length(0), pos(0), current(-1), scanned(0) {
+        load(0);
+    }
+
+    ~PostingsCursor() override {
+        QueryStats::global().add_postings_scanned(scanned);
+    }
+
+    int doc() const override { return current; }
+
+    int next() override {
+        if (current == END) return END;
+        if (current != -1) pos++;
+        while (pos >= length) {
+            if (block >= postings.num_blocks) {
+                return current = END;
+            }
+            load(block + 1);
+        }
+        return current = data[pos];
+    }
+
+    int advance(int target) override {
+        if (current >= target) return current;
+        if (segment_last_doc(block) < target) {
+            // Gallop over the skip table to the first block that can hold target
+            size_t num_blocks = postings.num_blocks;
+            size_t low = block + 1;
+            size_t step = 1;
+            size_t high = low;
+            while (high < num_blocks && postings.block_last_doc(high) < target) {
+                low = high + 1;
+                high += step;
+                step <<= 1;
+            }
+            high = std::min(high, num_blocks);
+            while (low < high) {
+                size_t mid = (low + high) / 2;
+                if (postings.block_last_doc(mid) < target) low = mid + 1;
+                else high = mid;
+            }
+            if (segment_last_doc(low) < target) {
+                return current = END;
+            }
+            load(low);
+        }
+        pos = gallop(data, pos, length, target);
+        return current = data[pos];
+    }
+
+    size_t cost() const override { return postings.size(); }
+
+    // Block of the current doc (num_blocks for the raw tail) and its position
+    // in the block
+    size_t current_block() const { return block; }
+    size_t current_position() const { return pos; }
+};
+
+// Intersection of its children, minus every doc of its excluded cursors.
+// Children are leapfrogged: the rarest one proposes a candidate and every
+// other child advances to it, so no intermediate result is built.
+class AndCursor : public DocCursor {
+private:
+    std::vector<std::unique_ptr<DocCursor>> children;
+    std::vector<std::unique_ptr<DocCursor>> excluded;
+    int current;
+
+    int find_from(int target) {
+        while (true) {
+            int candidate = children[0]->advance(target);
+            if (candidate == END) return END;
+            bool matches = true;
+            for (size_t i = 1; i < children.size(); ++i) {
+                int doc = children[i]->advance(candidate);
+                if (doc != candidate) {
+                    if (doc == END) return END;
+                    target = doc;
+                    matches = false;
+                    break;
+                }
+            }
+            if (!matches) continue;
+            for (auto& cursor : excluded) {
+                if (cursor->advance(candidate) == candidate) {
+                    matches = false;
+                    break;
+                }
+            }
+            if (matches) return candidate;
+            target = candidate + 1;
+        }
+    }
+
+public:
+    AndCursor(std::vector<std::unique_ptr<DocCursor>> children, std::vector<std::unique_ptr<DocCursor>> excluded)
+        : children(std::move(children)), excluded(std::move(excluded)), current(-1) {
+        std::stable_sort(this->children.begin(), this->children.end(),
+                         [](const auto& a, const auto& b) { return a->cost() < b->cost(); });
+    }
+
+    int doc() const override { return current; }
+    int next() override {
+        if (current == END) return END;
+        return current = find_from(current + 1);
+    }
+    int advance(int target) override {
+        if (current >= target) return current;
+        return current = find_from(target);
+    }
+    size_t cost() const override { return children[0]->cost(); }
+};
+
+// Union of its children
+class OrCursor : public DocCursor {
+private:
+    std::vector<std::unique_ptr<DocCursor>> children;
+    int current;
+
+    int smallest() const {
+        int result = END;
+        for (const auto& cursor : children) {
+            result = std::min(result, cursor->doc());
+        }
+        return result;
+    }
+
+public:
+    explicit OrCursor(std::vector<std::unique_ptr<DocCursor>> children)
+        : children(std::move(children)), current(-1) {}
+
+    int doc() const override { return current; }
+    int next() override {
+        if (current == END) return END;
+        return advance(current + 1);
+    }
+    int advance(int target) override {
+        if (current >= target) return current;
+        for (auto& cursor : children) {
+            if (cursor->doc() < target) cursor->advance(target);
+        }
+        return current = smallest();
+    }
+    size_t cost() const override {
+        size_t total = 0;
+        for (const auto& cursor : children) total += cursor->cost();
+        return total;
+    }
+};
+
+// Union of many children, kept in a min-heap on their current doc, so that a
+// step costs O(log k) in the number of children rather than O(k)
+class HeapOrCursor : public DocCursor {
+private:
+    std::vector<std::unique_ptr<DocCursor>> children;
+    std::vector<DocCursor*> heap;
+    int current;
+
+    static bool after(const DocCursor* a, const DocCursor* b) { return a->doc() > b->doc(); }
+
+public:
+    explicit HeapOrCursor(std::vector<std::unique_ptr<DocCursor>> children)
+        : children(std::move(children)), current(-1) {
+        for (auto& child : this->children) heap.push_back(child.get());
+        std::make_heap(heap.begin(), heap.end(), after);
+    }
+
+    int doc() const override { return current; }
+    int next() override {
+        if (current == END) return END;
+        return advance(current + 1);
+    }
+    int advance(int target) override {
+        if (current >= target) return current;
+        while (!heap.empty() && heap.front()->doc() < target) {
+            std::pop_heap(heap.begin(), heap.end(), after);
+            if (heap.back()->advance(target) == END) {
+                heap.pop_back();
+            } else {
+                std::push_heap(heap.begin(), heap.end(), after);
+            }
+        }
+        return current = heap.empty() ? END : heap.front()->doc();
+    }
+    size_t cost() const override {
+        size_t total = 0;
+        for (const auto& cursor : children) total += cursor->cost();
+        return total;
+    }
+};
+
+// Doc ids of [0, universe_size) not yielded by the child
+class NotCursor : public DocCursor {
+private:
+    std::unique_ptr<DocCursor> child;
+    int universe_size;
+    int current;
+public:
+    NotCursor(std::unique_ptr<DocCursor> child, int universe_size)
+        : child(std::move(child)), universe_size(universe_size), current(-1) {}
+
+    int doc() const override { return current; }
+    int next() override {
+        if (current == END) return END;
+        return advance(current + 1);
+    }
+    int advance(int target) override {
+        if (current >= target) return current;
+        int candidate = target;
+        while (candidate < universe_size && child->advance(candidate) == candidate) {
+            candidate++;
+        }
+        return current = candidate < universe_size ? candidate : END;
+    }
+    size_t cost() const override { return universe_size; }
+};
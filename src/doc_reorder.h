@@ -0,0 +1,168 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+#include <thread>
+#include <utility>
+
+// Terms of every document, in compressed sparse rows: the terms of doc d are
+// terms[offsets[d]] to terms[offsets[d + 1] - 1], as ids below num_terms
+struct ForwardIndex {
+    size_t num_terms = 0;
+    std::vector<size_t> offsets{0};
+    std::vector<uint32_t> terms;
+
+    size_t document_count() const { return offsets.size() - 1; }
+};
+
+// Document reordering by recursive graph bisection (Dhulipala et al., "Compressing
+// Graphs and Indexes with Recursive Graph Bisection", KDD 2016).
+//
+// The documents are split in two halves, and pairs of documents are swapped
+// between the halves as long as this lowers the estimated cost of encoding
+// the gaps of the postings: a term with d1 documents among the n1 of the left
+// half and d2 among the n2 of the right one costs about
+// d1 log(n1 / (d1 + 1)) + d2 log(n2 / (d2 + 1)) bits. Each half is then split
+// in turn, until partitions are small. Documents sharing terms end up with
+// close ids, which shortens the gaps of their postings and groups the docs
+// an intersection visits.
+class GraphBisection {
+public:
+    static constexpr size_t DEFAULT_ITERATIONS = 20;
+    // Partitions of at most this many documents are not split further
+    static constexpr size_t MIN_PARTITION = 16;
+
+private:
+    const ForwardIndex& forward;
+    size_t iterations;
+    std::vector<float> log2_table;  // log2(i), for i up to the document count + 2
+
+    // Degrees of the terms in each half of the partition being split. Only
+    // the entries of the partition's terms are used, and they are reset after.
+    struct Workspace {
+        std::vector<int32_t> left;
+        std::vector<int32_t> right;
+
+        explicit Workspace(size_t num_terms) : left(num_terms, 0), right(num_terms, 0) {}
+    };
+
+    float cost(int32_t degree, float log2_size) const {
+        return degree * (log2_size - log2_table[degree + 1]);
+    }
+
+    // Cost saved by moving a doc from the half where the term has degree
+    // `from` to the half where it has degree `to`
+    float move_gain(const uint32_t* begin, const uint32_t* end, const std::vector<int32_t>& from,
+                    const std::vector<int32_t>& to, float log2_from, float log2_to) const {
+        float gain = 0;
+        for (const uint32_t* t = begin; t != end; ++t) {
+            int32_t d1 = from[*t];
+            int32_t d2 = to[*t];
+            gain += cost(d1, log2_from) + cost(d2, log2_to) - cost(d1 - 1, log2_from) - cost(d2 + 1, log2_to);
+        }
+        return gain;
+    }
+
+    const uint32_t* terms_begin(int doc) const { return forward.terms.data() + forward.offsets[doc]; }
+    const uint32_t* terms_end(int doc) const { return forward.terms.data() + forward.offsets[doc + 1]; }
+
+    void bisect(int* docs, size_t n, Workspace& workspace, size_t spare_threads) const {
+        if (n <= MIN_PARTITION) {
+            std::sort(docs, docs + n);
+            return;
+        }
+        size_t half = n / 2;
+        for (size_t i = 0; i < n; ++i) {
+            auto& degrees = i < half ? workspace.left : workspace.right;
+            for (const uint32_t* t = terms_begin(docs[i]); t != terms_end(docs[i]); ++t) degrees[*t]++;
+        }
+
+        float log2_left = log2_table[half];
+        float log2_right = log2_table[n - half];
+        std::vector<std::pair<float, int>> left_gains(half);
+        std::vector<std::pair<float, int>> right_gains(n - half);
+        for (size_t iteration = 0; iteration < iterations; ++iteration) {
+            for (size_t i = 0; i < n; ++i) {
+                const uint32_t* begin = terms_begin(docs[i]);
+                const uint32_t* end = terms_end(docs[i]);
+                if (i < half) {
+                    left_gains[i] = {move_gain(begin, end, workspace.left, workspace.right, log2_left, log2_right),
+                                     docs[i]};
+                } else {
+                    right_gains[i - half] = {
+                        move_gain(begin, end, workspace.right, workspace.left, log2_right, log2_left), docs[i]};
+                }
+            }
+            auto by_gain = [](const std::pair<float, int>& a, const std::pair<float, int>& b) {
+                return a.first > b.first || (a.first == b.first && a.second < b.second);
+            };
+            std::sort(left_gains.begin(), left_gains.end(), by_gain);
+            std::sort(right_gains.begin(), right_gains.end(), by_gain);
+
+            size_t swaps = 0;
+            size_t limit = std::min(left_gains.size(), right_gains.size());
+            while (swaps < limit && left_gains[swaps].first + right_gains[swaps].first > 0) {
+                int to_right = left_gains[swaps].second;
+                int to_left = right_gains[swaps].second;
+                for (const uint32_t* t = terms_begin(to_right); t != terms_end(to_right); ++t) {
+                    workspace.left[*t]--;
+                    workspace.right[*t]++;
+                }
+                for (const uint32_t* t = terms_begin(to_left); t != terms_end(to_left); ++t) {
+                    workspace.right[*t]--;
+                    workspace.left[*t]++;
+                }
+                std::swap(left_gains[swaps].second, right_gains[swaps].second);
+                swaps++;
+            }
+            for (size_t i = 0; i < half; ++i) docs[i] = left_gains[i].second;
+            for (size_t i = half; i < n; ++i) docs[i] = right_gains[i - half].second;
+            if (swaps == 0) {
+                break;
+            }
+        }
+        for (size_t i = 0; i < n; ++i) {
+            for (const uint32_t* t = terms_begin(docs[i]); t != terms_end(docs[i]); ++t) {
+                workspace.left[*t] = 0;
+                workspace.right[*t] = 0;
+            }
+        }
+
+        // Split the halves concurrently while threads are left
+        if (spare_threads > 0) {
+            size_t left_threads = (spare_threads - 1) / 2;
+            std::thread left_half([&, left_threads]() {
+                Workspace own(forward.num_terms);
+                bisect(docs, half, own, left_threads);
+            });
+            bisect(docs + half, n - half, workspace, spare_threads - 1 - left_threads);
+            left_half.join();
+        } else {
+            bisect(docs, half, workspace, 0);
+            bisect(docs + half, n - half, workspace, 0);
+        }
+    }
+
+public:
+    GraphBisection(const ForwardIndex& forward, size_t iterations = DEFAULT_ITERATIONS)
+        : forward(forward), iterations(iterations), log2_table(forward.document_count() + 3, 0.0f) {
+        for (size_t i = 1; i < log2_table.size(); ++i) {
+            log2_table[i] = static_cast<float>(std::log2(double(i)));
+        }
+    }
+
+    // Documents in their new order, i.e. the original id of every new id.
+    // Top levels of the recursion are split over num_threads threads.
+    std::vector<int> order(size_t num_threads = 1) const {
+        std::vector<int> docs(forward.document_count());
+        for (size_t i = 0; i < docs.size(); ++i) {
+            docs[i] = static_cast<int>(i);
+        }
+        Workspace workspace(forward.num_terms);
+        bisect(docs.data(), docs.size(), workspace, num_threads > 0 ? num_threads - 1 : 0);
+        return docs;
+    }
+};
@@ -0,0 +1,393 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+#include <iterator>
+#include "postings.h"
+#include "query_stats.h"
+
+// Set of doc ids split into chunks of 2^16 ids, Roaring-style. Each chunk is a
+// sorted array of the low 16 bits while it holds at most ARRAY_MAX_SIZE ids,
+// and a 65536-bit bitmap otherwise, so that dense chunks are combined with
+// word-wise bitwise operations and complemented in O(N / 64).
+class DocSet {
+public:
+    static constexpr size_t ARRAY_MAX_SIZE = 4096;
+    static constexpr size_t BITMAP_WORDS = 1024;
+
+private:
+    struct Container {
+        uint16_t key;
+        uint32_t cardinality;
+        std::vector<uint16_t> array;
+        std::vector<uint64_t> bitmap;
+
+        explicit Container(uint16_t k = 0) : key(k), cardinality(0) {}
+
+        bool is_bitmap() const { return !bitmap.empty(); }
+
+        bool contains(uint16_t low) const {
+            if (is_bitmap()) {
+                return (bitmap[low >> 6] >> (low & 63)) & 1;
+            }
+            return std::binary_search(array.begin(), array.end(), low);
+        }
+
+        void to_bitmap() {
+            bitmap.assign(BITMAP_WORDS, 0);
+            for (uint16_t low : array) {
+                bitmap[low >> 6] |= uint64_t(1) << (low & 63);
+            }
+            std::vector<uint16_t>().swap(array);
+        }
+
+        // Recomputes the cardinality of a bitmap and demotes it to an array
+        // when it became sparse
+        void normalize() {
+            if (!is_bitmap()) {
+                cardinality = static_cast<uint32_t>(array.size());
+                return;
+            }
+            uint32_t card = 0;
+            for (uint64_t word : bitmap) {
+                card += __builtin_popcountll(word);
+            }
+            cardinality = card;
+            if (card <= ARRAY_MAX_SIZE) {
+                array.clear();
+                array.reserve(card);
+                for (size_t w = 0; w < BITMAP_WORDS; ++w) {
+                    uint64_t word = bitmap[w];
+                    while (word) {
+                        array.push_back(static_cast<uint16_t>(w * 64 + __builtin_ctzll(word)));
+                        word &= word - 1;
+                    }
+                }
+                std::vector<uint64_t>().swap(bitmap);
+            }
+        }
+
+        void push_back(uint16_t low) {
+            if (is_bitmap()) {
+                bitmap[low >> 6] |= uint64_t(1) << (low & 63);
+            } else {
+                array.push_back(low);
+                if (array.size() > ARRAY_MAX_SIZE) {
+                    to_bitmap();
+                }
+            }
+            cardinality++;
+        }
+    };
+
+    std::vector<Container> containers;
+
+    static Container intersect(const Container& a, const Container& b) {
+        Container result(a.key);
+        if (a.is_bitmap() && b.is_bitmap()) {
+            result.bitmap.resize(BITMAP_WORDS);
+            for (size_t w = 0; w < BITMAP_WORDS; ++w) {
+                result.bitmap[w] = a.bitmap[w] & b.bitmap[w];
+            }
+        } else if (a.is_bitmap() || b.is_bitmap()) {
+            const Container& arr = a.is_bitmap() ? b : a;
+            const Container& bmp = a.is_bitmap() ? a : b;
+            for (uint16_t low : arr.array) {
+                if (bmp.contains(low)) result.array.push_back(low);
+            }
+        } else {
+            std::set_intersection(a.array.begin(), a.array.end(), b.array.begin(), b.array.end(),
+                                  std::back_inserter(result.array));
+        }
+        result.normalize();
+        return result;
+    }
+
+    static size_t intersect_count(const Container& a, const Container& b) {
+        size_t count = 0;
+        if (a.is_bitmap() && b.is_bitmap()) {
+            for (size_t w = 0; w < BITMAP_WORDS; ++w) {
+                count += __builtin_popcountll(a.bitmap[w] & b.bitmap[w]);
+            }
+        } else if (a.is_bitmap() || b.is_bitmap()) {
+            const Container& arr = a.is_bitmap() ? b : a;
+            const Container& bmp = a.is_bitmap() ? a : b;
+            for (uint16_t low : arr.array) {
+                count += bmp.contains(low);
+            }
+        } else {
+            size_t i = 0, j = 0;
+            while (i < a.array.size() && j < b.array.size()) {
+                if (a.array[i] < b.array[j]) {
+                    i++;
+                } else if (b.array[j] < a.array[i]) {
+                    j++;
+                } else {
+                    count++;
+                    i++;
+                    j++;
+                }
+            }
+        }
+        return count;
+    }
+
+    static Container unite(const Container& a, const Container& b) {
+        Container result(a.key);
+        if (a.is_bitmap() || b.is_bitmap()) {
+            result.bitmap = a.is_bitmap() ? a.bitmap : b.bitmap;
+            const Container& other = a.is_bitmap() ? b : a;
+            if (other.is_bitmap()) {
+                for (size_t w = 0; w < BITMAP_WORDS; ++w) {
+                    result.bitmap[w] |= other.bitmap[w];
+                }
+            } else {
+                for (uint16_t low : other.array) {
+                    result.bitmap[low >> 6] |= uint64_t(1) << (low & 63);
+                }
+            }
+        } else {
+            std::set_union(a.array.begin(), a.array.end(), b.array.begin(), b.array.end(),
+                           std::back_inserter(result.array));
+            if (result.array.size() > ARRAY_MAX_SIZE) {
+                result.to_bitmap();
+            }
+        }
+        result.normalize();
+        return result;
+    }
+
+    static Container subtract(const Container& a, const Container& b) {
+        Container result(a.key);
+        if (a.is_bitmap()) {
+            result.bitmap = a.bitmap;
+            if (b.is_bitmap()) {
+                for (size_t w = 0; w < BITMAP_WORDS; ++w) {
+                    result.bitmap[w] &= ~b.bitmap[w];
+                }
+            } else {
+                for (uint16_t low : b.array) {
+                    result.bitmap[low >> 6] &= ~(uint64_t(1) << (low & 63));
+                }
+            }
+        } else if (b.is_bitmap()) {
+            for (uint16_t low : a.array) {
+                if (!b.contains(low)) result.array.push_back(low);
+            }
+        } else {
+            std::set_difference(a.array.begin(), a.array.end(), b.array.begin(), b.array.end(),
+                                std::back_inserter(result.array));
+        }
+        result.normalize();
+        return result;
+    }
+
+public:
+    DocSet() = default;
+
+    // Appends a doc id greater than every id already in the set
+    void push_back(int doc_id) {
+        uint16_t key = static_cast<uint16_t>(static_cast<uint32_t>(doc_id) >> 16);
+        if (containers.empty() || containers.back().key != key) {
+            containers.emplace_back(key);
+        }
+        containers.back().push_back(static_cast<uint16_t>(doc_id & 0xFFFF));
+    }
+
+    static DocSet from_sorted(const std::vector<int>& docs) {
+        DocSet result;
+        for (int doc : docs) {
+            result.push_back(doc);
+        }
+        return result;
+    }
+
+    static DocSet from_postings(const PostingsView& postings) {
+        DocSet result;
+        int buffer[BlockCodec::BLOCK_SIZE];
+        for (size_t b = 0; b < postings.num_blocks; ++b) {
+            postings.decode_block(b, buffer);
+            for (int doc : buffer) {
+                result.push_back(doc);
+            }
+        }
+        for (size_t i = 0; i < postings.tail_size; ++i) {
+            result.push_back(postings.tail[i]);
+        }
+        QueryStats::global().add_postings_scanned(postings.size());
+        return result;
+    }
+
+    // Set of the bits of a flat bitmap, bit i of words[i / 64] standing for id i
+    static DocSet from_bitmap(const std::vector<uint64_t>& words) {
+        DocSet result;
+        for (size_t first = 0; first < words.size(); first += BITMAP_WORDS) {
+            size_t last = std::min(words.size(), first + BITMAP_WORDS);
+            Container c(static_cast<uint16_t>(first / BITMAP_WORDS));
+            c.bitmap.assign(BITMAP_WORDS, 0);
+            std::copy(words.begin() + first, words.begin() + last, c.bitmap.begin());
+            c.normalize();
+            if (c.cardinality) result.containers.push_back(std::move(c));
+        }
+        return result;
+    }
+
+    // Every doc id in [0, universe_size)
+    static DocSet full(int universe_size) {
+        return DocSet().complement(universe_size);
+    }
+
+    bool empty() const { return containers.empty(); }
+
+    size_t cardinality() const {
+        size_t total = 0;
+        for (const auto& c : containers) {
+            total += c.cardinality;
+        }
+        return total;
+    }
+
+    bool contains(int doc_id) const {
+        uint16_t key = static_cast<uint16_t>(static_cast<uint32_t>(doc_id) >> 16);
+        auto it = std::lower_bound(containers.begin(), containers.end(), key,
+                                   [](const Container& c, uint16_t k) { return c.key < k; });
+        return it != containers.end() && it->key == key && it->contains(static_cast<uint16_t>(doc_id & 0xFFFF));
+    }
+
+    std::vector<int> to_vector() const {
+        std::vector<int> result;
+        result.reserve(cardinality());
+        for (const auto& c : containers) {
+            int high = static_cast<int>(c.key) << 16;
+            if (c.is_bitmap()) {
+                for (size_t w = 0; w < BITMAP_WORDS; ++w) {
+                    uint64_t word = c.bitmap[w];
+                    while (word) {
+                        result.push_back(high | static_cast<int>(w * 64 + __builtin_ctzll(word)));
+                        word &= word - 1;
+                    }
+                }
+            } else {
+                for (uint16_t low : c.array) {
+                    result.push_back(high | low);
+                }
+            }
+        }
+        return result;
+    }
+
+    DocSet intersect(const DocSet& other) const {
+        DocSet result;
+        size_t i = 0, j = 0;
+        while (i < containers.size() && j < other.containers.size()) {
+            const Container& a = containers[i];
+            const Container& b = other.containers[j];
+            if (a.key < b.key) {
+                i++;
+            } else if (b.key < a.key) {
+                j++;
+            } else {
+                Container c = intersect(a, b);
+                if (c.cardinality) result.containers.push_back(std::move(c));
+                i++;
+                j++;
+            }
+        }
+        return result;
+    }
+
+    // Cardinality of the intersection, without building it
+    size_t intersect_count(const DocSet& other) const {
+        size_t count = 0;
+        size_t i = 0, j = 0;
+        while (i < containers.size() && j < other.containers.size()) {
+            if (containers[i].key < other.containers[j].key) {
+                i++;
+            } else if (other.containers[j].key < containers[i].key) {
+                j++;
+            } else {
+                count += intersect_count(containers[i++], other.containers[j++]);
+            }
+        }
+        return count;
+    }
+
+    DocSet unite(const DocSet& other) const {
+        DocSet result;
+        size_t i = 0, j = 0;
+        while (i < containers.size() || j < other.containers.size()) {
+            if (j == other.containers.size() || (i < containers.size() && containers[i].key < other.containers[j].key)) {
+                result.containers.push_back(containers[i++]);
+            } else if (i == containers.size() || other.containers[j].key < containers[i].key) {
+                result.containers.push_back(other.containers[j++]);
+            } else {
+                result.containers.push_back(unite(containers[i++], other.containers[j++]));
+            }
+        }
+        return result;
+    }
+
+    DocSet subtract(const DocSet& other) const {
+        DocSet result;
+        size_t j = 0;
+        for (const Container& a : containers) {
+            while (j < other.containers.size() && other.containers[j].key < a.key) {
+                j++;
+            }
+            if (j < other.containers.size() && other.containers[j].key == a.key) {
+                Container c = subtract(a, other.containers[j]);
+                if (c.cardinality) result.containers.push_back(std::move(c));
+            } else {
+                result.containers.push_back(a);
+            }
+        }
+        return result;
+    }
+
+    // Doc ids of [0, universe_size) that are not in the set
+    DocSet complement(int universe_size) const {
+        DocSet result;
+        if (universe_size <= 0) return result;
+        size_t num_keys = ((static_cast<size_t>(universe_size) - 1) >> 16) + 1;
+        size_t i = 0;
+        for (size_t key = 0; key < num_keys; ++key) {
+            Container c(static_cast<uint16_t>(key));
+            c.bitmap.assign(BITMAP_WORDS, ~uint64_t(0));
+            if (i < containers.size() && containers[i].key == key) {
+                const Container& existing = containers[i++];
+                if (existing.is_bitmap()) {
+                    for (size_t w = 0; w < BITMAP_WORDS; ++w) {
+                        c.bitmap[w] = ~existing.bitmap[w];
+                    }
+                } else {
+                    for (uint16_t low : existing.array) {
+                        c.bitmap[low >> 6] &= ~(uint64_t(1) << (low & 63));
+                    }
+                }
+            }
+            if (key == num_keys - 1) {
+                // Clear the ids past the end of the universe
+                size_t end = static_cast<size_t>(universe_size) - (key << 16);
+                if (end % 64) {
+                    c.bitmap[end / 64] &= ~uint64_t(0) >> (64 - end % 64);
+                }
+                for (size_t w = (end + 63) / 64; w < BITMAP_WORDS; ++w) {
+                    c.bitmap[w] = 0;
+                }
+            }
+            c.normalize();
+            if (c.cardinality) result.containers.push_back(std::move(c));
+        }
+        return result;
+    }
+
+    size_t memory_usage() const {
+        size_t total = containers.capacity() * sizeof(Container);
+        for (const auto& c : containers) {
+            total += c.array.capacity() * sizeof(uint16_t) + c.bitmap.capacity() * sizeof(uint64_t);
+        }
+        return total;
+    }
+};
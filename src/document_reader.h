@@ -0,0 +1,263 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+// Reads the documents of a file one line at a time, so that files of any
+// size are streamed rather than loaded:
+// - Text: every line is a document
+// - TSV: the document is the column named `field` in the header line, or the
+//   column at index `field` (from 0) in a file without header
+// - JSONL: every non-blank line is a JSON object whose string member `field`
+//   is the document
+// A line without the column or member, or whose member is not a string, is
+// an empty document, so that doc ids follow the lines of the file. Lines that
+// are not valid JSON objects throw.
+class DocumentReader {
+public:
+    enum class Format { Text, TSV, JSONL };
+
+    static Format parse_format(const std::string& name) {
+        if (name == "text" || name == "txt") return Format::Text;
+        if (name == "tsv") return Format::TSV;
+        if (name == "jsonl" || name == "ndjson") return Format::JSONL;
+        throw std::runtime_error("Unknown document format: " + name);
+    }
+
+private:
+    std::ifstream file;
+    std::string path;
+    Format format;
+    std::string field;
+    size_t column;
+    std::string line;
+    size_t line_number;
+
+    bool read_line() {
+        if (!std::getline(file, line)) {
+            return false;
+        }
+        line_number++;
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        return true;
+    }
+
+    [[noreturn]] void fail(const std::string& message) const {
+        throw std::runtime_error(message + " on line " + std::to_string(line_number) + " of " + path);
+    }
+
+    void extract_column(std::string& text) const {
+        size_t start = 0;
+        for (size_t i = 0; i < column; ++i) {
+            start = line.find('\t', start);
+            if (start == std::string::npos) {
+                text.clear();
+                return;
+            }
+            start++;
+        }
+        size_t end = line.find('\t', start);
+        text.assign(line, start, end == std::string::npos ? std::string::npos : end - start);
+    }
+
+    void skip_spaces(size_t& pos) const {
+        while (pos < line.size() && (line[pos] == ' ' || line[pos] == '\t' || line[pos] == '\r' || line[pos] == '\n')) {
+            pos++;
+        }
+    }
+
+    static void append_utf8(std::string& out, uint32_t code) {
+        if (code < 0x80) {
+            out += static_cast<char>(code);
+        } else if (code < 0x800) {
+            out += static_cast<char>(0xC0 | (code >> 6));
+            out += static_cast<char>(0x80 | (code & 0x3F));
+        } else if (code < 0x10000) {
+            out += static_cast<char>(0xE0 | (code >> 12));
+            out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (code & 0x3F));
+        } else {
+            out += static_cast<char>(0xF0 | (code >> 18));
+            out += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+            out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (code & 0x3F));
+        }
+    }
+
+    uint32_t parse_hex4(size_t& pos) const {
+        if (pos + 4 > line.size()) fail("Truncated \\u escape");
+        uint32_t code = 0;
+        for (size_t end = pos + 4; pos < end; ++pos) {
+            char c = line[pos];
+            code <<= 4;
+            if (c >= '0' && c <= '9') code |= c - '0';
+            else if (c >= 'a' && c <= 'f') code |= c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F') code |= c - 'A' + 10;
+            else fail("Invalid \\u escape");
+        }
+        return code;
+    }
+
+    // Parses the JSON string at pos, decoding it into out unless out is null
+    void parse_string(size_t& pos, std::string* out) const {
+        if (pos >= line.size() || line[pos] != '"') fail("Expected a JSON string");
+        pos++;
+        while (true) {
+            size_t end = pos;
+            while (end < line.size() && line[end] != '"' && line[end] != '\\') end++;
+            if (end >= line.size()) fail("Unterminated JSON string");
+            if (out) out->append(line, pos, end - pos);
+            pos = end + 1;
+            if (line[end] == '"') return;
+            if (pos >= line.size()) fail("Unterminated JSON string");
+            char escape = line[pos++];
+            char decoded;
+            switch (escape) {
+                case '"': decoded = '"'; break;
+                case '\\': decoded = '\\'; break;
+                case '/': decoded = '/'; break;
+                case 'b': decoded = '\b'; break;
+                case 'f': decoded = '\f'; break;
+                case 'n': decoded = '\n'; break;
+                case 'r': decoded = '\r'; break;
+                case 't': decoded = '\t'; break;
+                case 'u': {
+                    uint32_t code = parse_hex4(pos);
+                    if (code >= 0xD800 && code < 0xDC00 && pos + 1 < line.size() && line[pos] == '\\' &&
+                        line[pos + 1] == 'u') {
+                        size_t next = pos + 2;
+                        uint32_t low = parse_hex4(next);
+                        if (low >= 0xDC00 && low < 0xE000) {
+                            code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                            pos = next;
+                        }
+                    }
+                    if (out) append_utf8(*out, code);
+                    continue;
+                }
+                default: fail("Invalid JSON escape");
+            }
+            if (out) *out += decoded;
+        }
+    }
+
+    // Skips the JSON value at pos
+    void skip_value(size_t& pos) const {
+        if (pos >= line.size()) fail("Expected a JSON value");
+        if (line[pos] == '"') {
+            parse_string(pos, nullptr);
+            return;
+        }
+        if (line[pos] == '{' || line[pos] == '[') {
+            size_t depth = 0;
+            while (pos < line.size()) {
+                char c = line[pos];
+                if (c == '"') {
+                    parse_string(pos, nullptr);
+                    continue;
+                }
+                pos++;
+                if (c == '{' || c == '[') {
+                    depth++;
+                } else if ((c == '}' || c == ']') && --depth == 0) {
+                    return;
+                }
+            }
+            fail("Unterminated JSON value");
+        }
+        size_t start = pos;
+        while (pos < line.size() && line[pos] != ',' && line[pos] != '}' && line[pos] != ']' && line[pos] != ' ' &&
+               line[pos] != '\t') {
+            pos++;
+        }
+        if (pos == start) fail("Expected a JSON value");
+    }
+
+    void extract_member(std::string& text) const {
+        text.clear();
+        size_t pos = 0;
+        skip_spaces(pos);
+        if (pos >= line.size() || line[pos] != '{') fail("Expected a JSON object");
+        pos++;
+        skip_spaces(pos);
+        if (pos < line.size() && line[pos] == '}') return;
+        std::string key;
+        while (true) {
+            key.clear();
+            parse_string(pos, &key);
+            skip_spaces(pos);
+            if (pos >= line.size() || line[pos] != ':') fail("Expected ':' in JSON object");
+            pos++;
+            skip_spaces(pos);
+            if (key == field && pos < line.size() && line[pos] == '"') {
+                parse_string(pos, &text);
+                return;
+            }
+            skip_value(pos);
+            skip_spaces(pos);
+            if (pos < line.size() && line[pos] == ',') {
+                pos++;
+                skip_spaces(pos);
+                continue;
+            }
+            if (pos < line.size() && line[pos] == '}') return;
+            fail("Expected ',' or '}' in JSON object");
+        }
+    }
+
+    static bool is_blank(const std::string& text) {
+        return text.find_first_not_of(" \t\r\n") == std::string::npos;
+    }
+
+public:
+    DocumentReader(const std::string& path, Format format, const std::string& field = "text")
+        : file(path), path(path), format(format), field(field), column(0), line_number(0) {
+        if (!file) {
+            throw std::runtime_error("Cannot open file: " + path);
+        }
+        if (format == Format::TSV) {
+            bool is_index = !field.empty() && field.find_first_not_of("0123456789") == std::string::npos;
+            if (is_index) {
+                column = std::stoul(field);
+            } else {
+                if (!read_line()) {
+                    throw std::runtime_error("Missing TSV header in " + path);
+                }
+                size_t start = 0;
+                for (column = 0;; ++column) {
+                    size_t end = line.find('\t', start);
+                    if (line.compare(start, end == std::string::npos ? std::string::npos : end - start, field) == 0) {
+                        break;
+                    }
+                    if (end == std::string::npos) {
+                        throw std::runtime_error("No column \"" + field + "\" in the TSV header of " + path);
+                    }
+                    start = end + 1;
+                }
+            }
+        }
+    }
+
+    // Reads the next document into text, false at the end of the file
+    bool next(std::string& text) {
+        while (read_line()) {
+            switch (format) {
+                case Format::Text:
+                    text.swap(line);
+                    return true;
+                case Format::TSV:
+                    extract_column(text);
+                    return true;
+                case Format::JSONL:
+                    if (is_blank(line)) continue;
+                    extract_member(text);
+                    return true;
+            }
+        }
+        return false;
+    }
+};
@@ -1,94 +1,1017 @@
 #pragma once
 
-#include <unordered_map>
 #include <vector>
 #include <string>
 #include <algorithm>
-#include <set>
+#include <cctype>
+#include <chrono>
 #include <fstream>
+#include <cstdint>
+#include <unordered_map>
+#include <unordered_set>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include "postings.h"
+#include "term_dictionary.h"
+#include "tokenizer.h"
+#include "document_reader.h"
+#include "doc_set.h"
+#include "doc_cursor.h"
 #include "query_tree.h"
+#include "query_plan.h"
+#include "query_cache.h"
+#include "result_cache.h"
+#include "query_profile.h"
+#include "query_stats.h"
+#include "ranking.h"
+#include "index_file.h"
+#include "doc_reorder.h"
+#include "parallel.h"
 
 class Index {
 private:
-    std::unordered_map<std::string, std::vector<int>> inverted_index;
+    TermDictionary dictionary;
+    // Per term id: the only doc id of a term seen in a single document, or
+    // -(position in postings_lists) - 1 once the term has a postings list.
+    // Most terms are hapax legomena, which thus never allocate a list.
+    std::vector<int32_t> term_postings;
+    std::vector<PostingsList> postings_lists;
     int current_doc_id;
+    bool compress_postings;
+    // With frequencies, the number of occurrences of each term in each doc,
+    // inline per term id for single-doc terms, and the length of every doc
+    bool store_frequencies;
+    std::vector<uint32_t> hapax_frequencies;
+    std::vector<uint32_t> document_lengths;
+    uint64_t total_length;
+    // Set when the index is served from a mapped file instead of the dictionary,
+    // shared with the views handed out by get_mapping()
+    std::shared_ptr<const MappedIndexFile> mapped;
+    // Parsed query strings, shared by concurrent searches
+    mutable QueryCache query_cache;
+    // Docs matching AND and OR subtrees, shared by every query, disabled
+    // until given a capacity
+    mutable ResultCache result_cache;
+    // Dictionary ids in lexicographic order of their terms, for patterns,
+    // built on first use and extended as terms are added
+    mutable std::shared_ptr<const std::vector<uint32_t>> sorted_terms;
+    mutable std::mutex sorted_terms_mutex;
+
+    // OR nodes with at least this many operands are materialized into a DocSet
+    // with bitmap unions instead of merging that many cursors doc by doc
+    static constexpr size_t MATERIALIZE_OR_FANOUT = 16;
+
+    // estimate_count() samples this many windows of doc ids, and counts
+    // exactly when they would be narrower than MIN_SAMPLE_WINDOW
+    static constexpr size_t SAMPLE_WINDOWS = 64;
+    static constexpr size_t MIN_SAMPLE_WINDOW = 32;
+
+    // Documents add_file() reads before indexing them together
+    static constexpr size_t INGEST_BATCH_SIZE = 16384;
 
-    std::vector<int> evaluate_node(const QueryNode* node) const {
-        if (const auto* word_node = dynamic_cast<const WordNode*>(node)) {
-            return get_postings(word_node->getWord());
-        } else if (const auto* not_node = dynamic_cast<const NotNode*>(node)) {
-            return evaluate_not(not_node);
-        } else if (const auto* and_node = dynamic_cast<const AndNode*>(node)) {
-            return evaluate_and(and_node);
-        } else if (const auto* or_node = dynamic_cast<const OrNode*>(node)) {
-            return evaluate_or(or_node);
-        } else if (const auto* andnot_node = dynamic_cast<const AndNotNode*>(node)) {
-            return evaluate_andnot(andnot_node);
+    // Smallest share of an add_documents batch worth giving to its own thread
+    static constexpr size_t MIN_DOCUMENTS_PER_THREAD = 256;
+
+    PostingsView find_postings(const std::string& word) const {
+        if (mapped) {
+            return mapped->find(word);
         }
-        return {};
+        uint32_t id = dictionary.find(word);
+        return id != TermDictionary::NOT_FOUND ? postings_of(id) : PostingsView();
     }
 
-    std::vector<int> evaluate_not(const NotNode* node) const {
-        std::vector<int> child_result = evaluate_node(node->getChild());
-        std::set<int> child_set(child_result.begin(), child_result.end());
-        std::vector<int> result;
-        for (int i = 0; i < current_doc_id; ++i) {
-            if (child_set.find(i) == child_set.end()) {
-                result.push_back(i);
+    PostingsView postings_of(uint32_t id) const {
+        if (term_postings[id] >= 0) {
+            PostingsView view;
+            view.tail = &term_postings[id];
+            view.tail_size = 1;
+            if (store_frequencies) {
+                view.with_frequencies = true;
+                view.tail_frequencies = &hapax_frequencies[id];
             }
+            return view;
         }
-        return result;
+        return postings_lists[-term_postings[id] - 1].view();
     }
 
-    std::vector<int> evaluate_and(const AndNode* node) const {
-        std::vector<int> left_result = evaluate_node(node->getLeft());
-        std::vector<int> right_result = evaluate_node(node->getRight());
-        std::vector<int> result;
-        std::set_intersection(left_result.begin(), left_result.end(),
-                              right_result.begin(), right_result.end(),
-                              std::back_inserter(result));
-        return result;
+    const uint32_t* lengths() const {
+        return mapped ? mapped->document_lengths() : document_lengths.data();
     }
 
-    std::vector<int> evaluate_or(const OrNode* node) const {
-        std::vector<int> left_result = evaluate_node(node->getLeft());
-        std::vector<int> right_result = evaluate_node(node->getRight());
-        std::vector<int> result;
-        std::set_union(left_result.begin(), left_result.end(),
-                       right_result.begin(), right_result.end(),
-                       std::back_inserter(result));
-        return result;
+    void push_posting(PostingsList& postings, int doc_id, uint32_t frequency) {
+        if (store_frequencies) {
+            postings.push_back(doc_id, frequency, document_lengths.data());
+        } else {
+            postings.push_back(doc_id);
+        }
     }
 
-    std::vector<int> evaluate_andnot(const AndNotNode* node) const {
-        std::vector<int> left_result = evaluate_node(node->getLeft());
-        std::vector<int> right_result = evaluate_node(node->getRight());
-        std::vector<int> result;
-        std::set_difference(left_result.begin(), left_result.end(),
-                            right_result.begin(), right_result.end(),
-                            std::back_inserter(result));
+    // Adds a doc to a term that already has one, moving a single doc to a
+    // postings list first
+    void append_posting(uint32_t id, int doc_id, uint32_t frequency) {
+        int32_t& value = term_postings[id];
+        if (value >= 0) {
+            postings_lists.emplace_back(compress_postings, store_frequencies);
+            push_posting(postings_lists.back(), value, store_frequencies ? hapax_frequencies[id] : 1);
+            value = -static_cast<int32_t>(postings_lists.size());
+        }
+        push_posting(postings_lists[-value - 1], doc_id, frequency);
+    }
+
+    // Adds a term read from a file, which must not repeat one
+    void add_term(std::string_view term, const PostingsView& postings) {
+        if (!dictionary.insert(term).second) {
+            throw std::runtime_error("Corrupted index file");
+        }
+        bool single = postings.size() == 1 && postings.num_blocks == 0;
+        if (single) {
+            term_postings.push_back(postings.tail[0]);
+        } else {
+            postings_lists.push_back(PostingsList::from_view(postings, compress_postings));
+            term_postings.push_back(-static_cast<int32_t>(postings_lists.size()));
+        }
+        if (store_frequencies) {
+            hapax_frequencies.push_back(single ? postings.tail_frequencies[0] : 0);
+        }
+    }
+
+    void clear_terms() {
+        mapped.reset();
+        dictionary.clear();
+        sorted_terms.reset();
+        result_cache.clear();
+        std::vector<int32_t>().swap(term_postings);
+        std::vector<PostingsList>().swap(postings_lists);
+        std::vector<uint32_t>().swap(hapax_frequencies);
+        std::vector<uint32_t>().swap(document_lengths);
+        total_length = 0;
+    }
+
+    // Words of the query that a matching doc may contain, i.e. those not
+    // under an odd number of negations, with patterns expanded. May repeat.
+    void collect_scored_words(const QueryTree& tree, uint32_t index, bool negated,
+                              std::vector<std::string>& words) const {
+        const FlatQueryNode& node = tree.getNode(index);
+        switch (node.op) {
+            case QueryOp::Pattern:
+                if (!negated) {
+                    for (auto& match : expand_pattern(tree.getWord(index))) words.push_back(std::move(match.first));
+                }
+                break;
+            case QueryOp::Word:
+                if (!negated) words.emplace_back(tree.getWord(index));
+                break;
+            case QueryOp::Not:
+                collect_scored_words(tree, node.left, !negated, words);
+                break;
+            default:
+                collect_scored_words(tree, node.left, negated, words);
+                collect_scored_words(tree, node.right, node.op == QueryOp::AndNot ? !negated : negated, words);
+                break;
+        }
+    }
+
+    std::shared_ptr<const std::vector<uint32_t>> sorted_term_ids() const {
+        std::lock_guard<std::mutex> lock(sorted_terms_mutex);
+        size_t known = sorted_terms ? sorted_terms->size() : 0;
+        if (known < dictionary.size()) {
+            // Terms are only ever added, so merge the new ones in
+            auto ids = std::make_shared<std::vector<uint32_t>>();
+            ids->reserve(dictionary.size());
+            if (sorted_terms) ids->assign(sorted_terms->begin(), sorted_terms->end());
+            for (uint32_t id = static_cast<uint32_t>(known); id < dictionary.size(); ++id) ids->push_back(id);
+            auto by_term = [this](uint32_t a, uint32_t b) { return dictionary.term(a) < dictionary.term(b); };
+            std::sort(ids->begin() + known, ids->end(), by_term);
+            std::inplace_merge(ids->begin(), ids->begin() + known, ids->end(), by_term);
+            sorted_terms = std::move(ids);
+        }
+        return sorted_terms ? sorted_terms : std::make_shared<const std::vector<uint32_t>>();
+    }
+
+    // Every term matching the pattern in lexicographic order, with its postings
+    std::vector<std::pair<std::string, PostingsView>> expand_pattern(std::string_view pattern) const {
+        std::vector<std::pair<std::string, PostingsView>> matches;
+        std::string_view prefix = WordPattern::prefix(pattern);
+        if (mapped) {
+            mapped->for_each_with_prefix(prefix, [&](std::string_view term, const PostingsView& postings) {
+                if (WordPattern::matches(pattern, term)) matches.emplace_back(std::string(term), postings);
+            });
+            return matches;
+        }
+        auto ids = sorted_term_ids();
+        auto it = std::lower_bound(ids->begin(), ids->end(), prefix,
+                                   [this](uint32_t id, std::string_view p) { return dictionary.term(id) < p; });
+        for (; it != ids->end(); ++it) {
+            std::string_view term = dictionary.term(*it);
+            if (term.compare(0, prefix.size(), prefix) != 0) break;
+            if (WordPattern::matches(pattern, term)) matches.emplace_back(std::string(term), postings_of(*it));
+        }
+        return matches;
+    }
+
+    QueryPlanner planner() const {
+        return QueryPlanner([this](const std::string& word) { return find_postings(word); },
+                            [this](std::string_view pattern) { return expand_pattern(pattern); }, current_doc_id);
+    }
+
+    // Plans carry the keys of their nodes when the result cache is enabled
+    std::unique_ptr<PlanNode> plan(const QueryTree& query_tree) const {
+        auto root = planner().plan(query_tree);
+        if (result_cache.enabled()) {
+            root->assignKeys();
+        }
+        return root;
+    }
+
+    // Number of docs of the postings set in the bitmap
+    static size_t count_in_bitmap(const std::vector<uint64_t>& bitmap, const PostingsView& postings) {
+        size_t count = 0;
+        int buffer[BlockCodec::BLOCK_SIZE];
+        for (size_t b = 0; b < postings.num_blocks; ++b) {
+            postings.decode_block(b, buffer);
+            for (int doc : buffer) {
+                count += (bitmap[doc >> 6] >> (doc & 63)) & 1;
+            }
+        }
+        for (size_t i = 0; i < postings.tail_size; ++i) {
+            int doc = postings.tail[i];
+            count += (bitmap[doc >> 6] >> (doc & 63)) & 1;
+        }
+        QueryStats::global().add_postings_scanned(postings.size());
+        return count;
+    }
+
+    // Number of sorted docs found in the postings
+    static size_t count_in_postings(const std::vector<int>& docs, const PostingsView& postings) {
+        PostingsCursor cursor(postings);
+        size_t count = 0;
+        for (int doc : docs) {
+            int found = cursor.advance(doc);
+            if (found == DocCursor::END) break;
+            count += found == doc;
+        }
+        return count;
+    }
+
+    // Fills the description of a single plan node, as evaluated by
+    // make_cursor() with the same `wanted`
+    static void describe(const PlanNode* node, size_t wanted, QueryProfile& profile) {
+        profile.estimate = node->estimate;
+        switch (node->op) {
+            case PlanOp::Empty:
+                profile.op = "EMPTY";
+                profile.algorithm = "empty";
+                break;
+            case PlanOp::All:
+                profile.op = "ALL";
+                profile.algorithm = "all docs";
+                break;
+            case PlanOp::Term:
+                profile.op = "TERM";
+                profile.word = node->word;
+                profile.postings = node->postings.size();
+                profile.algorithm = "postings cursor";
+                break;
+            case PlanOp::Not:
+                profile.op = "NOT";
+                profile.algorithm = "complement";
+                break;
+            case PlanOp::And:
+                profile.op = "AND";
+                profile.excluded = node->excluded.size();
+                profile.algorithm = node->excluded.empty() ? "leapfrog intersection"
+                                                           : "leapfrog intersection with exclusions";
+                break;
+            case PlanOp::Or:
+                profile.op = "OR";
+                profile.algorithm = materializes(node, wanted) ? "bitmap union"
+                                    : node->children.size() >= MATERIALIZE_OR_FANOUT ? "heap merge"
+                                                                                     : "cursor merge";
+                break;
+        }
+        profile.children.resize(node->children.size() + node->excluded.size());
+    }
+
+    static void explain_node(const PlanNode* node, size_t wanted, QueryProfile& profile) {
+        describe(node, wanted, profile);
+        size_t child_wanted = node->op == PlanOp::Or ? wanted : SIZE_MAX;
+        size_t i = 0;
+        for (const auto& child : node->children) explain_node(child.get(), child_wanted, profile.children[i++]);
+        for (const auto& child : node->excluded) explain_node(child.get(), SIZE_MAX, profile.children[i++]);
+    }
+
+    static bool materializes(const PlanNode* node, size_t wanted) {
+        return node->op == PlanOp::Or && node->children.size() >= MATERIALIZE_OR_FANOUT &&
+               wanted > node->estimate / node->children.size();
+    }
+
+    // `wanted` bounds the number of docs the caller reads from the cursor, so
+    // that a wide OR is merged lazily rather than materialized when only a few
+    // of its docs are needed. With a profile, every cursor of the tree records
+    // its statistics in the matching node of the profile. `cacheable` tells
+    // that the node and its operands may be evaluated in full for the result
+    // cache, which only queries read in full afford.
+    std::unique_ptr<DocCursor> make_cursor(const PlanNode* node, size_t wanted = SIZE_MAX,
+                                           QueryProfile* profile = nullptr, bool cacheable = false) const {
+        if (!profile) {
+            return build_cursor(node, wanted, nullptr, cacheable);
+        }
+        auto start = std::chrono::steady_clock::now();
+        describe(node, wanted, *profile);
+        auto cursor = build_cursor(node, wanted, profile, cacheable);
+        profile->seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return std::make_unique<ProfilingCursor>(std::move(cursor), *profile);
+    }
+
+    // Reads AND and OR nodes from the result cache when it is enabled. A node
+    // missing from the cache is stored when it is materialized anyway, as a
+    // wide OR, or when it is cacheable and already missed before. Otherwise
+    // it is evaluated like without the cache, so that an operand a lazy
+    // parent only leapfrogs over is never read in full.
+    std::unique_ptr<DocCursor> build_cursor(const PlanNode* node, size_t wanted, QueryProfile* profile,
+                                            bool cacheable) const {
+        if (!result_cache.enabled() || node->key.empty() || (node->op != PlanOp::And && node->op != PlanOp::Or)) {
+            return build_uncached_cursor(node, wanted, profile, cacheable);
+        }
+        bool materialized = materializes(node, wanted);
+        ResultCache::Entry entry;
+        if (result_cache.find(node->key, entry, cacheable || materialized)) {
+            if (entry.document_count < current_doc_id) {
+                // Documents were added since: evaluate the node over them only
+                auto docs = std::make_shared<std::vector<int>>(*entry.docs);
+                auto cursor = build_uncached_cursor(node, SIZE_MAX, nullptr, false);
+                for (int doc = cursor->advance(entry.document_count); doc != DocCursor::END; doc = cursor->next()) {
+                    docs->push_back(doc);
+                }
+                entry = {std::move(docs), current_doc_id};
+                result_cache.put(node->key, entry, true);
+            }
+            if (profile) {
+                profile->algorithm = "cached result";
+                profile->children.clear();
+                profile->bytes = sizeof(VectorCursor);
+            }
+            return std::make_unique<VectorCursor>(entry.docs);
+        }
+        if (!materialized && !(cacheable && result_cache.admit(node->key))) {
+            return build_uncached_cursor(node, wanted, profile, cacheable);
+        }
+        auto docs = std::make_shared<std::vector<int>>();
+        auto cursor = build_uncached_cursor(node, SIZE_MAX, profile, true);
+        for (int doc = cursor->next(); doc != DocCursor::END; doc = cursor->next()) {
+            docs->push_back(doc);
+        }
+        docs->shrink_to_fit();
+        result_cache.put(node->key, {docs, current_doc_id});
+        if (profile) {
+            profile->algorithm += ", cached";
+            profile->bytes += docs->capacity() * sizeof(int);
+        }
+        return std::make_unique<VectorCursor>(std::shared_ptr<const std::vector<int>>(std::move(docs)));
+    }
+
+    std::unique_ptr<DocCursor> build_uncached_cursor(const PlanNode* node, size_t wanted, QueryProfile* profile,
+                                                     bool cacheable) const {
+        auto child_profile = [profile](size_t i) { return profile ? &profile->children[i] : nullptr; };
+        switch (node->op) {
+            case PlanOp::Empty:
+                return std::make_unique<EmptyCursor>();
+            case PlanOp::All:
+                return std::make_unique<AllCursor>(current_doc_id);
+            case PlanOp::Term:
+                if (profile) profile->bytes = sizeof(PostingsCursor);
+                return std::make_unique<PostingsCursor>(node->postings);
+            case PlanOp::Not:
+                if (profile) profile->bytes = sizeof(NotCursor);
+                return std::make_unique<NotCursor>(
+                    make_cursor(node->children[0].get(), SIZE_MAX, child_profile(0), cacheable), current_doc_id);
+            case PlanOp::And: {
+                std::vector<std::unique_ptr<DocCursor>> children, excluded;
+                size_t i = 0;
+                for (const auto& child : node->children) {
+                    children.push_back(make_cursor(child.get(), SIZE_MAX, child_profile(i++), cacheable));
+                }
+                for (const auto& child : node->excluded) {
+                    excluded.push_back(make_cursor(child.get(), SIZE_MAX, child_profile(i++), cacheable));
+                }
+                if (profile) profile->bytes = sizeof(AndCursor) + i * sizeof(std::unique_ptr<DocCursor>);
+                return std::make_unique<AndCursor>(std::move(children), std::move(excluded));
+            }
+            case PlanOp::Or: {
+                if (materializes(node, wanted)) {
+                    std::vector<int> docs = evaluate_set(node).to_vector();
+                    if (profile) {
+                        // Operands are read whole by the bitmap union, not through cursors
+                        explain_node(node, wanted, *profile);
+                        profile->bytes = sizeof(VectorCursor) + docs.capacity() * sizeof(int);
+                    }
+                    return std::make_unique<VectorCursor>(std::move(docs));
+                }
+                return merge_cursor(node, wanted, profile, cacheable);
+            }
+        }
+        return std::make_unique<EmptyCursor>();
+    }
+
+    // Lazy union of the operands of an OR
+    std::unique_ptr<DocCursor> merge_cursor(const PlanNode* node, size_t wanted, QueryProfile* profile,
+                                            bool cacheable) const {
+        std::vector<std::unique_ptr<DocCursor>> children;
+        size_t i = 0;
+        for (const auto& child : node->children) {
+            children.push_back(make_cursor(child.get(), wanted, profile ? &profile->children[i] : nullptr, cacheable));
+            i++;
+        }
+        if (children.size() >= MATERIALIZE_OR_FANOUT) {
+            if (profile) profile->bytes = sizeof(HeapOrCursor) + i * (sizeof(std::unique_ptr<DocCursor>) + sizeof(DocCursor*));
+            return std::make_unique<HeapOrCursor>(std::move(children));
+        }
+        if (profile) profile->bytes = sizeof(OrCursor) + i * sizeof(std::unique_ptr<DocCursor>);
+        return std::make_unique<OrCursor>(std::move(children));
+    }
+
+    // A dense union is accumulated in a flat bitmap of the collection, in one
+    // pass over its operands; a sparse one is merged through a heap.
+    DocSet evaluate_set(const PlanNode* node) const {
+        if (node->op == PlanOp::Term) {
+            return DocSet::from_postings(node->postings);
+        } else if (node->op == PlanOp::Or && node->estimate >= static_cast<size_t>(current_doc_id) / 64) {
+            std::vector<uint64_t> bitmap((static_cast<size_t>(current_doc_id) + 63) / 64, 0);
+            auto set = [&bitmap](int doc) { bitmap[doc >> 6] |= uint64_t(1) << (doc & 63); };
+            int buffer[BlockCodec::BLOCK_SIZE];
+            for (const auto& child : node->children) {
+                if (child->op != PlanOp::Term) {
+                    auto cursor = make_cursor(child.get(), SIZE_MAX, nullptr, true);
+                    for (int doc = cursor->next(); doc != DocCursor::END; doc = cursor->next()) set(doc);
+                    continue;
+                }
+                const PostingsView& postings = child->postings;
+                for (size_t b = 0; b < postings.num_blocks; ++b) {
+                    postings.decode_block(b, buffer);
+                    for (int doc : buffer) set(doc);
+                }
+                for (size_t i = 0; i < postings.tail_size; ++i) set(postings.tail[i]);
+                QueryStats::global().add_postings_scanned(postings.size());
+            }
+            return DocSet::from_bitmap(bitmap);
+        }
+        DocSet result;
+        auto cursor = node->op == PlanOp::Or ? merge_cursor(node, SIZE_MAX, nullptr, true)
+                                             : make_cursor(node, SIZE_MAX, nullptr, true);
+        for (int doc = cursor->next(); doc != DocCursor::END; doc = cursor->next()) {
+            result.push_back(doc);
+        }
         return result;
     }
 
+    size_t count_node(const PlanNode* node) const {
+        switch (node->op) {
+            case PlanOp::Empty: return 0;
+            case PlanOp::All: return current_doc_id;
+            case PlanOp::Term: return node->postings.size();
+            case PlanOp::Not: return current_doc_id - count_node(node->children[0].get());
+            default: break;
+        }
+        size_t total = 0;
+        auto cursor = make_cursor(node, SIZE_MAX, nullptr, true);
+        while (cursor->next() != DocCursor::END) {
+            total++;
+        }
+        return total;
+    }
+
+    // Counts the docs of a few evenly spaced windows of doc ids covering
+    // about sample_fraction of the collection, and scales the count up
+    size_t estimate_node(const PlanNode* node, double sample_fraction) const {
+        size_t universe_size = current_doc_id;
+        switch (node->op) {
+            case PlanOp::Empty:
+            case PlanOp::All:
+            case PlanOp::Term:
+                return count_node(node);
+            case PlanOp::Not:
+                return universe_size - std::min(universe_size, estimate_node(node->children[0].get(), sample_fraction));
+            default: break;
+        }
+        size_t width = static_cast<size_t>(universe_size * sample_fraction / SAMPLE_WINDOWS);
+        if (sample_fraction >= 1.0 || width < MIN_SAMPLE_WINDOW) {
+            return count_node(node);
+        }
+
+        auto cursor = make_cursor(node, width * SAMPLE_WINDOWS);
+        size_t matches = 0;
+        size_t sampled = 0;
+        for (size_t i = 0; i < SAMPLE_WINDOWS; ++i) {
+            size_t begin = i * universe_size / SAMPLE_WINDOWS;
+            size_t end = std::min(begin + width, universe_size);
+            for (int doc = cursor->advance(static_cast<int>(begin)); static_cast<size_t>(doc) < end;
+                 doc = cursor->next()) {
+                matches++;
+            }
+            sampled += end - begin;
+        }
+        size_t estimate = static_cast<size_t>(double(matches) * universe_size / sampled + 0.5);
+        return std::min(estimate, node->estimate);
+    }
+
+    // Doc set of every node of a query tree, computed bottom up, indexed by
+    // node. A term met in several leaves is only read once.
+    void evaluate_tree(const QueryTree& tree, uint32_t index, std::vector<DocSet>& sets,
+                       std::vector<const DocSet*>& terms) const {
+        const FlatQueryNode& node = tree.getNode(index);
+        switch (node.op) {
+            case QueryOp::Word:
+                if (terms[node.left]) {
+                    sets[index] = *terms[node.left];
+                } else {
+                    sets[index] = DocSet::from_postings(find_postings(std::string(tree.getWord(index))));
+                    terms[node.left] = &sets[index];
+                }
+                break;
+            case QueryOp::Pattern:
+                sets[index] = evaluate_set(planner().plan(tree, index).get());
+                break;
+            case QueryOp::Not:
+                evaluate_tree(tree, node.left, sets, terms);
+                sets[index] = sets[node.left].complement(current_doc_id);
+                break;
+            case QueryOp::And:
+            case QueryOp::Or:
+            case QueryOp::AndNot: {
+                evaluate_tree(tree, node.left, sets, terms);
+                evaluate_tree(tree, node.right, sets, terms);
+                const DocSet& left = sets[node.left];
+                const DocSet& right = sets[node.right];
+                sets[index] = node.op == QueryOp::And  ? left.intersect(right)
+                              : node.op == QueryOp::Or ? left.unite(right)
+                                                       : left.subtract(right);
+                break;
+            }
+        }
+    }
+
+    // How the result of a whole query depends on one of its leaves: replacing
+    // the leaf by a set X makes the query match ((X or, when negated, its
+    // complement) & scope) | rest, where rest is disjoint from scope
+    struct LeafContext {
+        DocSet scope;
+        DocSet leaf_in_scope;
+        bool negated;
+        size_t rest_count;
+    };
+
+    // Walks down from the root, folding the siblings met on the way into the
+    // context, and records one context per leaf in left to right order
+    void collect_leaf_contexts(const QueryTree& tree, uint32_t index, const std::vector<DocSet>& sets,
+                               DocSet scope, bool negated, size_t rest_count,
+                               std::vector<LeafContext>& contexts) const {
+        const FlatQueryNode& node = tree.getNode(index);
+        if (node.op == QueryOp::Word || node.op == QueryOp::Pattern) {
+            DocSet leaf_in_scope = sets[index].intersect(scope);
+            contexts.push_back({std::move(scope), std::move(leaf_in_scope), negated, rest_count});
+            return;
+        }
+        if (node.op == QueryOp::Not) {
+            collect_leaf_contexts(tree, node.left, sets, std::move(scope), !negated, rest_count, contexts);
+            return;
+        }
+        const uint32_t children[2] = {node.left, node.right};
+        bool is_or = node.op == QueryOp::Or;
+        bool is_and_not = node.op == QueryOp::AndNot;
+        for (int side = 0; side < 2; ++side) {
+            const DocSet& sibling = sets[children[1 - side]];
+            DocSet inside = scope.intersect(sibling);
+            DocSet outside = scope.subtract(sibling);
+            size_t inside_count = inside.cardinality();
+            size_t outside_count = outside.cardinality();
+            if (is_or) {
+                // x | s matches the whole scope inside s
+                collect_leaf_contexts(tree, children[side], sets, std::move(outside), negated,
+                                      rest_count + (negated ? 0 : inside_count), contexts);
+            } else if (is_and_not && side == 0) {
+                // x & ~s matches nothing inside s, so its complement matches all of it
+                collect_leaf_contexts(tree, children[side], sets, std::move(outside), negated,
+                                      rest_count + (negated ? inside_count : 0), contexts);
+            } else {
+                // x & s, or s & ~x for the right side of AND NOT
+                collect_leaf_contexts(tree, children[side], sets, std::move(inside), is_and_not ? !negated : negated,
+                                      rest_count + (negated ? outside_count : 0), contexts);
+            }
+        }
+    }
+
 public:
-    Index() : current_doc_id(0) {}
+    explicit Index(bool compress_postings = true, bool store_frequencies = false)
+        : current_doc_id(0), compress_postings(compress_postings), store_frequencies(store_frequencies),
+          total_length(0) {}
 
-    void add_document(const std::vector<std::string>& words) {
-        for (const auto& word : words) {
-            auto& postings = inverted_index[word];
-            if (postings.empty() || postings.back() != current_doc_id) {
-                postings.push_back(current_doc_id);
+    // Adds one document, whose words for_each_word(emit) passes one by one to
+    // emit(std::string_view)
+    template <typename ForEachWord>
+    void add_words(ForEachWord&& for_each_word) {
+        if (mapped) {
+            throw std::runtime_error("Cannot add documents to a memory-mapped index");
+        }
+        if (store_frequencies) {
+            // Count the occurrences of each term first, as the frequencies of
+            // a packed block cannot be incremented afterwards
+            std::vector<uint32_t> ids;
+            for_each_word([&](std::string_view word) {
+                auto inserted = dictionary.insert(word);
+                if (inserted.second) {
+                    term_postings.push_back(current_doc_id);
+                    hapax_frequencies.push_back(0);
+                }
+                ids.push_back(inserted.first);
+            });
+            document_lengths.push_back(static_cast<uint32_t>(ids.size()));
+            total_length += ids.size();
+            std::sort(ids.begin(), ids.end());
+            for (size_t i = 0, j = 0; i < ids.size(); i = j) {
+                while (j < ids.size() && ids[j] == ids[i]) j++;
+                uint32_t frequency = static_cast<uint32_t>(j - i);
+                if (term_postings[ids[i]] == current_doc_id) {
+                    hapax_frequencies[ids[i]] = frequency;
+                } else {
+                    append_posting(ids[i], current_doc_id, frequency);
+                }
             }
+            current_doc_id++;
+            return;
         }
+        for_each_word([&](std::string_view word) {
+            auto inserted = dictionary.insert(word);
+            if (inserted.second) {
+                term_postings.push_back(current_doc_id);
+                return;
+            }
+            int32_t& value = term_postings[inserted.first];
+            if (value >= 0) {
+                if (value != current_doc_id) {
+                    // Second document for the term: move it to a postings list
+                    postings_lists.emplace_back(compress_postings);
+                    postings_lists.back().push_back(value);
+                    postings_lists.back().push_back(current_doc_id);
+                    value = -static_cast<int32_t>(postings_lists.size());
+                }
+            } else {
+                PostingsList& postings = postings_lists[-value - 1];
+                if (postings.back() != current_doc_id) {
+                    postings.push_back(current_doc_id);
+                }
+            }
+        });
         current_doc_id++;
     }
 
+    // Adds `count` documents, equivalent to calling add_words on each of them
+    // in order, with the words of document i passed by for_each_word(i, emit).
+    // Contiguous ranges of the batch are indexed by per-thread builders, whose
+    // postings are then appended to the global lists in doc id order, with
+    // terms partitioned across the workers. for_each_word is then called
+    // concurrently for different documents.
+    template <typename ForEachWord>
+    void add_batch(size_t count, ForEachWord&& for_each_word, size_t num_threads) {
+        if (mapped) {
+            throw std::runtime_error("Cannot add documents to a memory-mapped index");
+        }
+        if (num_threads == 0) {
+            num_threads = default_thread_count();
+        }
+        num_threads = std::min(num_threads, count / MIN_DOCUMENTS_PER_THREAD);
+        if (num_threads <= 1) {
+            for (size_t i = 0; i < count; ++i) {
+                add_words([&](auto&& emit) { for_each_word(i, emit); });
+            }
+            return;
+        }
+
+        // Build local postings for each range of documents
+        struct LocalBuilder {
+            TermDictionary terms;
+            std::vector<std::vector<int>> postings;
+            std::vector<std::vector<uint32_t>> frequencies;
+            std::vector<uint32_t> lengths;
+            std::vector<uint32_t> global_ids;
+        };
+        std::vector<LocalBuilder> builders(num_threads);
+        size_t range = (count + num_threads - 1) / num_threads;
+        parallel_for(num_threads, num_threads, [&](size_t t) {
+            LocalBuilder& builder = builders[t];
+            size_t end = std::min(count, (t + 1) * range);
+            for (size_t i = t * range; i < end; ++i) {
+                int doc_id = current_doc_id + static_cast<int>(i);
+                uint32_t length = 0;
+                for_each_word(i, [&](std::string_view word) {
+                    length++;
+                    auto inserted = builder.terms.insert(word);
+                    if (inserted.second) {
+                        builder.postings.emplace_back();
+                        if (store_frequencies) builder.frequencies.emplace_back();
+                    }
+                    auto& postings = builder.postings[inserted.first];
+                    if (postings.empty() || postings.back() != doc_id) {
+                        postings.push_back(doc_id);
+                        if (store_frequencies) builder.frequencies[inserted.first].push_back(1);
+                    } else if (store_frequencies) {
+                        builder.frequencies[inserted.first].back()++;
+                    }
+                });
+                if (store_frequencies) builder.lengths.push_back(length);
+            }
+        });
+
+        // Resolve global term ids and allocate every postings list the batch
+        // needs, so that the parallel merge below only appends to them
+        uint32_t first_new_id = static_cast<uint32_t>(dictionary.size());
+        std::vector<size_t> new_docs;
+        for (auto& builder : builders) {
+            builder.global_ids.resize(builder.terms.size());
+            for (uint32_t local = 0; local < builder.terms.size(); ++local) {
+                auto inserted = dictionary.insert(builder.terms.term(local));
+                if (inserted.second) {
+                    term_postings.push_back(builder.postings[local].front());
+                    if (store_frequencies) hapax_frequencies.push_back(builder.frequencies[local].front());
+                }
+                builder.global_ids[local] = inserted.first;
+                if (new_docs.size() <= inserted.first) {
+                    new_docs.resize(dictionary.size(), 0);
+                }
+                new_docs[inserted.first] += builder.postings[local].size();
+            }
+        }
+        for (const auto& builder : builders) {
+            for (uint32_t length : builder.lengths) {
+                document_lengths.push_back(length);
+                total_length += length;
+            }
+        }
+        for (uint32_t id = 0; id < new_docs.size(); ++id) {
+            bool is_new = id >= first_new_id;
+            if (new_docs[id] == 0 || term_postings[id] < 0 || (is_new && new_docs[id] == 1)) {
+                continue;
+            }
+            postings_lists.emplace_back(compress_postings, store_frequencies);
+            if (!is_new) {
+                push_posting(postings_lists.back(), term_postings[id], store_frequencies ? hapax_frequencies[id] : 1);
+            }
+            term_postings[id] = -static_cast<int32_t>(postings_lists.size());
+        }
+
+        parallel_for(num_threads, num_threads, [&](size_t worker) {
+            for (const auto& builder : builders) {
+                for (uint32_t local = 0; local < builder.global_ids.size(); ++local) {
+                    uint32_t id = builder.global_ids[local];
+                    if (id % num_threads != worker || term_postings[id] >= 0) {
+                        continue;
+                    }
+                    PostingsList& postings = postings_lists[-term_postings[id] - 1];
+                    const auto& docs = builder.postings[local];
+                    for (size_t i = 0; i < docs.size(); ++i) {
+                        push_posting(postings, docs[i], store_frequencies ? builder.frequencies[local][i] : 1);
+                    }
+                }
+            }
+        });
+
+        current_doc_id += static_cast<int>(count);
+    }
+
+    void add_document(const std::vector<std::string>& words) {
+        add_words([&](auto&& emit) {
+            for (const auto& word : words) emit(word);
+        });
+    }
+
+    void add_documents(const std::vector<std::vector<std::string>>& documents, size_t num_threads = 0) {
+        add_batch(documents.size(), [&](size_t i, auto&& emit) {
+            for (const auto& word : documents[i]) emit(word);
+        }, num_threads);
+    }
+
+    // Tokenizes raw text and indexes it as one document
+    void add_text(std::string_view text, const Tokenizer& tokenizer = Tokenizer()) {
+        add_words([&](auto&& emit) { tokenizer.tokenize(text, emit); });
+    }
+
+    void add_texts(const std::vector<std::string>& texts, const Tokenizer& tokenizer = Tokenizer(),
+                   size_t num_threads = 0) {
+        add_batch(texts.size(), [&](size_t i, auto&& emit) { tokenizer.tokenize(texts[i], emit); }, num_threads);
+    }
+
+    // Streams the documents of a file through the tokenizer, a batch of lines
+    // at a time, and returns the number of documents added. See DocumentReader
+    // for the formats. A malformed line throws after the documents before it
+    // are added, with their number in the message.
+    size_t add_file(const std::string& path, DocumentReader::Format format = DocumentReader::Format::Text,
+                    const std::string& field = "text", const Tokenizer& tokenizer = Tokenizer(),
+                    size_t num_threads = 0) {
+        if (mapped) {
+            throw std::runtime_error("Cannot add documents to a memory-mapped index");
+        }
+        DocumentReader reader(path, format, field);
+        std::vector<std::string> batch(INGEST_BATCH_SIZE);
+        size_t total = 0;
+        while (true) {
+            size_t count = 0;
+            std::string error;
+            try {
+                while (count < batch.size() && reader.next(batch[count])) {
+                    count++;
+                }
+            } catch (const std::runtime_error& e) {
+                error = e.what();
+            }
+            if (count > 0) {
+                add_batch(count, [&](size_t i, auto&& emit) { tokenizer.tokenize(batch[i], emit); }, num_threads);
+                total += count;
+            }
+            if (!error.empty()) {
+                throw std::runtime_error(error + " (" + std::to_string(total) + " documents added before it)");
+            }
+            if (count == 0) {
+                break;
+            }
+        }
+        return total;
+    }
+
+    // Appends the documents of another index after those of this one. Doc ids
+    // of `other` listed in `excluded` are left out of every postings list but
+    // keep their place, so that the ids of the following documents are kept.
+    void append(const Index& other, const DocSet* excluded = nullptr) {
+        if (mapped) {
+            throw std::runtime_error("Cannot add documents to a memory-mapped index");
+        }
+        if (&other == this) {
+            throw std::runtime_error("Cannot append an index to itself");
+        }
+        if (store_frequencies && !other.store_frequencies) {
+            throw std::runtime_error("Cannot append an index without term frequencies");
+        }
+        int offset = current_doc_id;
+        if (store_frequencies) {
+            // Postings lists with frequencies read the lengths of their docs
+            document_lengths.insert(document_lengths.end(), other.lengths(), other.lengths() + other.current_doc_id);
+            total_length += other.total_length;
+        }
+        auto append_term = [&](std::string_view term, const PostingsView& view) {
+            std::vector<int> docs = view.decode();
+            std::vector<uint32_t> frequencies;
+            if (store_frequencies) frequencies = view.decode_frequencies();
+            size_t kept = 0;
+            for (size_t i = 0; i < docs.size(); ++i) {
+                if (excluded && excluded->contains(docs[i])) continue;
+                docs[kept] = docs[i] + offset;
+                if (store_frequencies) frequencies[kept] = frequencies[i];
+                kept++;
+            }
+            if (kept == 0) {
+                return;
+            }
+            auto inserted = dictionary.insert(term);
+            size_t i = 0;
+            if (inserted.second) {
+                term_postings.push_back(docs[i]);
+                if (store_frequencies) hapax_frequencies.push_back(frequencies[i]);
+                i++;
+            }
+            for (; i < kept; ++i) {
+                append_posting(inserted.first, docs[i], store_frequencies ? frequencies[i] : 1);
+            }
+        };
+        if (other.mapped) {
+            other.mapped->for_each(append_term);
+        } else {
+            for (uint32_t id = 0; id < other.dictionary.size(); ++id) {
+                append_term(other.dictionary.term(id), other.postings_of(id));
+            }
+        }
+        current_doc_id += other.current_doc_id;
+    }
+
+    // Renumbers the documents so that those sharing terms get close ids, by
+    // recursive graph bisection, which makes postings smaller and queries
+    // touch fewer blocks. Returns the original id of every document, in the
+    // new order, to translate results back. Terms found in a single document
+    // do not weigh on the order.
+    std::vector<int> reorder(size_t iterations = GraphBisection::DEFAULT_ITERATIONS, size_t num_threads = 0) {
+        if (mapped) {
+            throw std::runtime_error("Cannot reorder a memory-mapped index");
+        }
+        if (num_threads == 0) {
+            num_threads = default_thread_count();
+        }
+
+        // Terms of each doc, counted and then filled from the postings lists
+        ForwardIndex forward;
+        forward.num_terms = postings_lists.size();
+        forward.offsets.assign(current_doc_id + 1, 0);
+        for (const auto& postings : postings_lists) {
+            for (int doc : postings.decode()) forward.offsets[doc + 1]++;
+        }
+        for (int doc = 0; doc < current_doc_id; ++doc) {
+            forward.offsets[doc + 1] += forward.offsets[doc];
+        }
+        forward.terms.resize(forward.offsets.back());
+        std::vector<size_t> filled(forward.offsets.begin(), forward.offsets.end() - 1);
+        for (uint32_t list = 0; list < postings_lists.size(); ++list) {
+            for (int doc : postings_lists[list].decode()) forward.terms[filled[doc]++] = list;
+        }
+        std::vector<size_t>().swap(filled);
+
+        std::vector<int> order = GraphBisection(forward, iterations).order(num_threads);
+        forward = ForwardIndex();
+        result_cache.clear();
+        std::vector<int> new_ids(current_doc_id);
+        for (int doc = 0; doc < current_doc_id; ++doc) {
+            new_ids[order[doc]] = doc;
+        }
+
+        if (store_frequencies) {
+            std::vector<uint32_t> reordered(current_doc_id);
+            for (int doc = 0; doc < current_doc_id; ++doc) {
+                reordered[doc] = document_lengths[order[doc]];
+            }
+            document_lengths.swap(reordered);
+        }
+        for (int32_t& value : term_postings) {
+            if (value >= 0) value = new_ids[value];
+        }
+        parallel_for(postings_lists.size(), num_threads, [&](size_t list) {
+            PostingsView view = postings_lists[list].view();
+            std::vector<std::pair<int, uint32_t>> postings(view.size());
+            std::vector<int> old_docs = view.decode();
+            std::vector<uint32_t> frequencies = store_frequencies ? view.decode_frequencies()
+                                                                  : std::vector<uint32_t>(old_docs.size(), 1);
+            for (size_t i = 0; i < old_docs.size(); ++i) {
+                postings[i] = {new_ids[old_docs[i]], frequencies[i]};
+            }
+            std::sort(postings.begin(), postings.end());
+            PostingsList reordered(compress_postings, store_frequencies);
+            for (const auto& posting : postings) {
+                push_posting(reordered, posting.first, posting.second);
+            }
+            postings_lists[list] = std::move(reordered);
+        });
+        return order;
+    }
+
     std::vector<int> get_postings(const std::string& word) const {
-        auto it = inverted_index.find(word);
-        if (it != inverted_index.end()) {
-            return it->second;
+        return find_postings(word).decode();
+    }
+
+    // Postings of a word as stored. The view points into the index, so it is
+    // invalidated by add_document, or by load() and map() when the index is
+    // mapped, unless the caller holds get_mapping().
+    PostingsView get_postings_view(const std::string& word) const {
+        return find_postings(word);
+    }
+
+    // The file the index is served from, nullptr unless mapped. Holding it
+    // keeps views into the mapping valid after the index moves on.
+    std::shared_ptr<const MappedIndexFile> get_mapping() const {
+        return mapped;
+    }
+
+    bool is_compressed() const {
+        return compress_postings;
+    }
+
+    bool is_mapped() const {
+        return mapped != nullptr;
+    }
+
+    bool has_frequencies() const {
+        return store_frequencies;
+    }
+
+    // Heap memory held by the postings and words, excluding any mapped file
+    size_t memory_usage() const {
+        size_t total = dictionary.memory_usage() + term_postings.capacity() * sizeof(int32_t) +
+                       postings_lists.capacity() * sizeof(PostingsList) +
+                       (hapax_frequencies.capacity() + document_lengths.capacity()) * sizeof(uint32_t);
+        for (const auto& postings : postings_lists) {
+            total += postings.memory_usage();
         }
-        return {};
+        return total;
+    }
+
+    // Every indexed word, in lexicographic order
+    std::vector<std::string> get_terms() const {
+        std::vector<std::string> terms;
+        if (mapped) {
+            terms.reserve(mapped->term_count());
+            mapped->for_each([&](std::string_view term, const PostingsView&) { terms.emplace_back(term); });
+        } else {
+            terms.reserve(dictionary.size());
+            auto ids = sorted_term_ids();
+            for (uint32_t id : *ids) {
+                terms.emplace_back(dictionary.term(id));
+            }
+        }
+        return terms;
     }
 
     int get_document_count() const {
@@ -96,46 +1019,351 @@ public:
     }
 
     std::vector<int> search(const QueryTree& query_tree) const {
-        return evaluate_node(query_tree.getRoot());
+        auto timer = QueryStats::Timer::evaluate();
+        std::vector<int> result;
+        auto cursor = make_cursor(plan(query_tree).get(), SIZE_MAX, nullptr, true);
+        for (int doc = cursor->next(); doc != DocCursor::END; doc = cursor->next()) {
+            result.push_back(doc);
+        }
+        return result;
+    }
+
+    // Writes the first `capacity` matching doc ids to `out` and returns the
+    // total number of matches
+    size_t search_into(const QueryTree& query_tree, int* out, size_t capacity) const {
+        auto timer = QueryStats::Timer::evaluate();
+        size_t total = 0;
+        auto cursor = make_cursor(plan(query_tree).get(), SIZE_MAX, nullptr, true);
+        for (int doc = cursor->next(); doc != DocCursor::END; doc = cursor->next()) {
+            if (total < capacity) {
+                out[total] = doc;
+            }
+            total++;
+        }
+        return total;
+    }
+
+    size_t search_into(const std::string& query_string, int* out, size_t capacity, bool ignore_case = true) const {
+        return search_into(*query_cache.get(query_string, ignore_case), out, capacity);
     }
 
     std::vector<int> search(const std::string& query_string, bool ignore_case = true) const {
-        QueryTree query_tree(query_string, ignore_case);
-        return search(query_tree);
+        return search(*query_cache.get(query_string, ignore_case));
     }
 
     int count(const QueryTree& query_tree) const {
-        return evaluate_node(query_tree.getRoot()).size();
+        auto timer = QueryStats::Timer::evaluate();
+        return count_node(plan(query_tree).get());
     }
 
     int count(const std::string& query_string, bool ignore_case = true) const {
-        return search(query_string, ignore_case).size();
+        return count(*query_cache.get(query_string, ignore_case));
     }
 
-    void save(const std::string& filename) const {
-        std::ofstream file(filename, std::ios::binary);
-        if (!file) {
-            throw std::runtime_error("Could not open file for writing");
+    // At most `limit` matching doc ids, skipping the first `offset` ones: the
+    // same ids as slicing search(), but evaluation stops at the last one
+    std::vector<int> search_page(const QueryTree& query_tree, size_t limit, size_t offset = 0) const {
+        auto timer = QueryStats::Timer::evaluate();
+        std::vector<int> result;
+        if (limit == 0) {
+            return result;
         }
+        size_t wanted = offset + std::min(limit, SIZE_MAX - offset);
+        auto cursor = make_cursor(plan(query_tree).get(), wanted);
+        size_t position = 0;
+        for (int doc = cursor->next(); doc != DocCursor::END; doc = cursor->next()) {
+            if (position++ < offset) {
+                continue;
+            }
+            result.push_back(doc);
+            if (result.size() == limit) {
+                break;
+            }
+        }
+        return result;
+    }
 
-        // Save current_doc_id
-        file.write(reinterpret_cast<const char*>(&current_doc_id), sizeof(current_doc_id));
+    std::vector<int> search_page(const std::string& query_string, size_t limit, size_t offset = 0,
+                                 bool ignore_case = true) const {
+        return search_page(*query_cache.get(query_string, ignore_case), limit, offset);
+    }
 
-        // Save inverted_index
-        size_t index_size = inverted_index.size();
-        file.write(reinterpret_cast<const char*>(&index_size), sizeof(index_size));
+    // Whether any doc matches, stopping at the first one
+    bool exists(const QueryTree& query_tree) const {
+        auto timer = QueryStats::Timer::evaluate();
+        auto root = plan(query_tree);
+        switch (root->op) {
+            case PlanOp::Empty: return false;
+            case PlanOp::All: return current_doc_id > 0;
+            case PlanOp::Term: return true;
+            default: break;
+        }
+        return make_cursor(root.get(), 1)->next() != DocCursor::END;
+    }
 
-        for (const auto& entry : inverted_index) {
-            // Save word
-            size_t word_length = entry.first.length();
-            file.write(reinterpret_cast<const char*>(&word_length), sizeof(word_length));
-            file.write(entry.first.c_str(), word_length);
+    bool exists(const std::string& query_string, bool ignore_case = true) const {
+        return exists(*query_cache.get(query_string, ignore_case));
+    }
 
-            // Save postings list
-            size_t postings_size = entry.second.size();
-            file.write(reinterpret_cast<const char*>(&postings_size), sizeof(postings_size));
-            file.write(reinterpret_cast<const char*>(entry.second.data()), postings_size * sizeof(int));
+    // Approximate count() from about sample_fraction of the doc ids, for broad
+    // queries on large collections. Single terms and small collections are
+    // counted exactly. sample_fraction must be in (0, 1].
+    int estimate_count(const QueryTree& query_tree, double sample_fraction = 0.01) const {
+        if (!(sample_fraction > 0.0 && sample_fraction <= 1.0)) {
+            throw std::invalid_argument("sample_fraction must be in (0, 1]");
         }
+        auto timer = QueryStats::Timer::evaluate();
+        return static_cast<int>(estimate_node(plan(query_tree).get(), sample_fraction));
+    }
+
+    int estimate_count(const std::string& query_string, double sample_fraction = 0.01, bool ignore_case = true) const {
+        return estimate_count(*query_cache.get(query_string, ignore_case), sample_fraction);
+    }
+
+    // The plan the query is evaluated with, one profile node per plan node.
+    // The plan flattens chains of AND and OR and pushes negations down, so
+    // its nodes do not map one to one to those of the QueryTree.
+    QueryProfile explain(const QueryTree& query_tree) const {
+        QueryProfile result;
+        explain_node(plan(query_tree).get(), SIZE_MAX, result);
+        return result;
+    }
+
+    QueryProfile explain(const std::string& query_string, bool ignore_case = true) const {
+        return explain(*query_cache.get(query_string, ignore_case));
+    }
+
+    // Evaluates the query as search() does and returns its plan along with
+    // what each node produced and cost
+    QueryProfile profile(const QueryTree& query_tree) const {
+        auto timer = QueryStats::Timer::evaluate();
+        QueryProfile result;
+        auto root = plan(query_tree);
+        auto cursor = make_cursor(root.get(), SIZE_MAX, &result, true);
+        while (cursor->next() != DocCursor::END) {}
+        return result;
+    }
+
+    QueryProfile profile(const std::string& query_string, bool ignore_case = true) const {
+        return profile(*query_cache.get(query_string, ignore_case));
+    }
+
+    // Number of parsed query strings kept for reuse, 0 to disable the cache
+    void set_query_cache_size(size_t size) {
+        query_cache.set_capacity(size);
+    }
+
+    // Bytes the result cache may hold, 0 (the default) to disable it. When
+    // enabled, AND and OR subtrees seen a second time by queries evaluated in
+    // full (search, count, profile), and wide ORs materialized anyway, are
+    // kept and reused by any later query containing them, extended with the
+    // documents added in between. Paginated, exists() and estimated queries
+    // reuse entries but never evaluate more than they need to fill them.
+    void set_result_cache_size(size_t bytes) {
+        result_cache.set_capacity(bytes);
+        if (bytes == 0) {
+            result_cache.clear();
+        }
+    }
+
+    void clear_result_cache() {
+        result_cache.clear();
+    }
+
+    ResultCache::Counters get_result_cache_stats() const {
+        return result_cache.get();
+    }
+
+    void reset_result_cache_stats() {
+        result_cache.reset_counters();
+    }
+
+    // Parses and evaluates a batch of queries on num_threads workers (0 for one
+    // per core), returning the results in input order
+    std::vector<std::vector<int>> search_many(const std::vector<std::string>& query_strings,
+                                              bool ignore_case = true, size_t num_threads = 0) const {
+        std::vector<std::vector<int>> results(query_strings.size());
+        parallel_for(query_strings.size(), num_threads, [&](size_t i) {
+            results[i] = search(query_strings[i], ignore_case);
+        });
+        return results;
+    }
+
+    std::vector<int> count_many(const std::vector<std::string>& query_strings,
+                                bool ignore_case = true, size_t num_threads = 0) const {
+        std::vector<int> results(query_strings.size());
+        parallel_for(query_strings.size(), num_threads, [&](size_t i) {
+            results[i] = count(query_strings[i], ignore_case);
+        });
+        return results;
+    }
+
+    // Terms of the index matching a pattern such as "inter*" or "colo?r", in
+    // lexicographic order, i.e. those a pattern query would search
+    std::vector<std::string> match_terms(std::string pattern, bool ignore_case = true) const {
+        if (ignore_case) {
+            for (char& c : pattern) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        }
+        std::vector<std::string> terms;
+        for (auto& match : expand_pattern(pattern)) terms.push_back(std::move(match.first));
+        return terms;
+    }
+
+    // Counts every expansion of generateAllExpansions(word) for each candidate
+    // word, in the same order: row i holds, for each leaf of the tree from left
+    // to right, the counts of (leaf AND word), (leaf OR word) and
+    // (leaf AND NOT word). The tree is evaluated once, after which each count
+    // only takes two set intersections, whatever the size of the tree.
+    std::vector<std::vector<int>> count_expansions(const QueryTree& query_tree,
+                                                   const std::vector<std::string>& candidate_words,
+                                                   size_t num_threads = 0) const {
+        auto timer = QueryStats::Timer::evaluate();
+        std::vector<DocSet> sets(query_tree.numNodes());
+        std::vector<const DocSet*> terms(query_tree.numTerms(), nullptr);
+        evaluate_tree(query_tree, query_tree.getRootIndex(), sets, terms);
+        std::vector<LeafContext> contexts;
+        collect_leaf_contexts(query_tree, query_tree.getRootIndex(), sets, DocSet::full(current_doc_id), false, 0,
+                              contexts);
+        sets.clear();
+
+        std::vector<std::vector<int>> results(candidate_words.size());
+        parallel_for(candidate_words.size(), num_threads, [&](size_t i) {
+            DocSet word = DocSet::from_postings(find_postings(candidate_words[i]));
+            std::vector<int>& row = results[i];
+            row.reserve(contexts.size() * 3);
+            for (const auto& context : contexts) {
+                size_t scope_size = context.scope.cardinality();
+                size_t leaf_size = context.leaf_in_scope.cardinality();
+                size_t word_size = word.intersect_count(context.scope);
+                size_t both = word.intersect_count(context.leaf_in_scope);
+                // Matches of the expanded leaf within the scope, per operator
+                for (size_t inside : {both, leaf_size + word_size - both, leaf_size - both}) {
+                    size_t total = context.rest_count + (context.negated ? scope_size - inside : inside);
+                    row.push_back(static_cast<int>(total));
+                }
+            }
+        });
+        return results;
+    }
+
+    // count("(base) AND term") for every term, in order, with the base query
+    // evaluated once. A term is counted by probing its postings against a
+    // bitmap of the base, or, when the base is too sparse to reach most of its
+    // blocks, by advancing a cursor over the term to each doc of the base.
+    std::vector<int> count_cooccurrences(const QueryTree& base_query, const std::vector<std::string>& terms,
+                                         size_t num_threads = 0) const {
+        auto timer = QueryStats::Timer::evaluate();
+        std::vector<int> base = evaluate_set(plan(base_query).get()).to_vector();
+        std::vector<uint64_t> bitmap((static_cast<size_t>(current_doc_id) + 63) / 64, 0);
+        for (int doc : base) {
+            bitmap[doc >> 6] |= uint64_t(1) << (doc & 63);
+        }
+        std::vector<int> counts(terms.size(), 0);
+        parallel_for(terms.size(), num_threads, [&](size_t i) {
+            PostingsView postings = find_postings(terms[i]);
+            size_t count = base.size() * BlockCodec::BLOCK_SIZE < postings.size() ? count_in_postings(base, postings)
+                                                                                   : count_in_bitmap(bitmap, postings);
+            counts[i] = static_cast<int>(count);
+        });
+        return counts;
+    }
+
+    // Same as above, with the terms lowercased like the query when ignore_case
+    std::vector<int> count_cooccurrences(const std::string& base_query, std::vector<std::string> terms,
+                                         bool ignore_case = true, size_t num_threads = 0) const {
+        if (ignore_case) {
+            for (auto& term : terms) {
+                std::transform(term.begin(), term.end(), term.begin(),
+                               [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+            }
+        }
+        return count_cooccurrences(*query_cache.get(base_query, ignore_case), terms, num_threads);
+    }
+
+    // The k matching docs with the highest BM25 score, best first, as
+    // (doc id, score) pairs. The query filters the docs as in search(), and
+    // the score sums the words a matching doc may contain, i.e. those not
+    // under a negation. Matching docs that contain none of them score 0 and
+    // only fill the remaining places, in doc id order. Requires an index
+    // storing term frequencies.
+    std::vector<std::pair<int, double>> search_topk(const QueryTree& query_tree, size_t k) const {
+        auto timer = QueryStats::Timer::evaluate();
+        if (!store_frequencies) {
+            throw std::runtime_error("Ranking requires an index with term frequencies");
+        }
+        auto root = plan(query_tree);
+        BM25 bm25(current_doc_id, total_length);
+        std::vector<std::string> words;
+        collect_scored_words(query_tree, query_tree.getRootIndex(), false, words);
+        std::vector<std::unique_ptr<TermScorer>> terms;
+        std::unordered_set<std::string> seen;
+        for (const auto& word : words) {
+            if (!seen.insert(word).second) continue;
+            PostingsView postings = find_postings(word);
+            if (!postings.empty()) {
+                terms.push_back(std::make_unique<TermScorer>(postings, bm25, lengths()));
+            }
+        }
+        auto filter = make_cursor(root.get());
+        auto results = top_k(*filter, terms, k);
+
+        if (results.size() < k) {
+            // Every scored match made it, so any other match scores 0
+            std::vector<int> scored;
+            for (const auto& result : results) scored.push_back(result.first);
+            std::sort(scored.begin(), scored.end());
+            auto matches = make_cursor(root.get());
+            for (int doc = matches->next(); doc != DocCursor::END && results.size() < k; doc = matches->next()) {
+                if (!std::binary_search(scored.begin(), scored.end(), doc)) {
+                    results.emplace_back(doc, 0.0);
+                }
+            }
+        }
+        return results;
+    }
+
+    std::vector<std::pair<int, double>> search_topk(const std::string& query_string, size_t k,
+                                                    bool ignore_case = true) const {
+        return search_topk(*query_cache.get(query_string, ignore_case), k);
+    }
+
+    void save(const std::string& filename) const {
+        std::vector<IndexFile::Term> terms;
+        if (mapped) {
+            // Mapped terms are decoded on the fly, so keep copies alive
+            std::vector<std::string> words;
+            words.reserve(mapped->term_count());
+            terms.reserve(mapped->term_count());
+            mapped->for_each([&](std::string_view term, const PostingsView& postings) {
+                words.emplace_back(term);
+                terms.emplace_back(std::string_view(), postings);
+            });
+            for (size_t i = 0; i < words.size(); ++i) {
+                terms[i].first = words[i];
+            }
+            IndexFile::write(filename, current_doc_id, compress_postings, terms,
+                             store_frequencies ? lengths() : nullptr);
+            return;
+        }
+        terms.reserve(dictionary.size());
+        auto ids = sorted_term_ids();
+        for (uint32_t id : *ids) {
+            terms.emplace_back(dictionary.term(id), postings_of(id));
+        }
+        IndexFile::write(filename, current_doc_id, compress_postings, terms, store_frequencies ? lengths() : nullptr);
+    }
+
+    // Serves the index straight from a file written by save(), without copying
+    // it: the index becomes read-only and shares its pages with every other
+    // process mapping the same file
+    void map(const std::string& filename) {
+        auto file = std::make_shared<const MappedIndexFile>(filename);
+        clear_terms();
+        current_doc_id = file->document_count();
+        compress_postings = file->is_compressed();
+        store_frequencies = file->has_frequencies();
+        total_length = file->total_length();
+        mapped = std::move(file);
     }
 
     void load(const std::string& filename) {
@@ -144,13 +1372,44 @@ public:
             throw std::runtime_error("Could not open file for reading");
         }
 
+        // Load header, falling back to the legacy uncompressed layout
+        uint32_t header[3];
+        file.read(reinterpret_cast<char*>(header), sizeof(header));
+        bool legacy = !file || header[0] != IndexFile::MAGIC;
+        if (!legacy && header[1] >= IndexFile::MIN_MAPPED_VERSION && header[1] <= IndexFile::VERSION) {
+            // Copy a mapped file into memory so that the index stays writable
+            MappedIndexFile source(filename);
+            clear_terms();
+            dictionary.reserve(source.term_count());
+            compress_postings = source.is_compressed();
+            store_frequencies = source.has_frequencies();
+            current_doc_id = source.document_count();
+            if (store_frequencies) {
+                document_lengths.assign(source.document_lengths(), source.document_lengths() + current_doc_id);
+                total_length = source.total_length();
+            }
+            source.for_each([this](std::string_view term, const PostingsView& postings) {
+                add_term(term, postings);
+            });
+            return;
+        }
+        if (legacy) {
+            file.clear();
+            file.seekg(0);
+        } else if (header[1] != 1) {
+            throw std::runtime_error("Unsupported index file version");
+        } else {
+            compress_postings = header[2] != 0;
+        }
+
         // Clear existing data
-        inverted_index.clear();
+        clear_terms();
+        store_frequencies = false;
 
         // Load current_doc_id
         file.read(reinterpret_cast<char*>(&current_doc_id), sizeof(current_doc_id));
 
-        // Load inverted_index
+        // Load terms
         size_t index_size;
         file.read(reinterpret_cast<char*>(&index_size), sizeof(index_size));
 
@@ -162,12 +1421,24 @@ public:
             file.read(&word[0], word_length);
 
             // Load postings list
-            size_t postings_size;
-            file.read(reinterpret_cast<char*>(&postings_size), sizeof(postings_size));
-            std::vector<int> postings(postings_size);
-            file.read(reinterpret_cast<char*>(postings.data()), postings_size * sizeof(int));
+            PostingsList postings;
+            if (legacy) {
+                size_t postings_size;
+                file.read(reinterpret_cast<char*>(&postings_size), sizeof(postings_size));
+                std::vector<int> docs(postings_size);
+                file.read(reinterpret_cast<char*>(docs.data()), postings_size * sizeof(int));
+                postings = PostingsList::from_sorted(docs, compress_postings);
+            } else {
+                postings = PostingsList::read(file, compress_postings);
+            }
+            if (!postings.view().is_valid(current_doc_id)) {
+                throw std::runtime_error("Corrupted index file");
+            }
+            add_term(word, postings.view());
+        }
 
-            inverted_index[word] = std::move(postings);
+        if (!file) {
+            throw std::runtime_error("Could not read index file");
         }
     }
 
@@ -0,0 +1,460 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <string_view>
+#include <fstream>
+#include <memory>
+#include <queue>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <stdexcept>
+#include <utility>
+#include "postings.h"
+#include "term_dictionary.h"
+#include "tokenizer.h"
+#include "document_reader.h"
+#include "index_file.h"
+
+// Builds an index file for a corpus of any size under a fixed memory budget.
+//
+// Documents are indexed in memory, as by Index, until the buffered postings
+// and words reach the budget. The buffer is then spilled to a run file, its
+// terms in lexicographic order, and indexing starts afresh. finish() merges
+// the runs term by term into the index file, which Index::map() or load()
+// then open. Runs hold consecutive documents, so the postings of a term are
+// the concatenation of its postings in each run, in run order.
+//
+// Besides the budget, memory holds the read buffers of MERGE_FANIN runs, the
+// term blocks of the output and the compressed postings of a single term.
+// Document lengths, when frequencies are stored, go straight to a temporary
+// file that the merge maps to compute block impacts.
+//
+// Temporary files are created next to the output and removed when done.
+class IndexBuilder {
+public:
+    static constexpr size_t DEFAULT_MEMORY_BUDGET = size_t(256) << 20;
+    // Number of runs merged at once; more runs are first merged into larger runs
+    static constexpr size_t MERGE_FANIN = 64;
+
+private:
+    // Run files list terms in lexicographic order, each as the varint length
+    // of the term, its bytes and its varint number of docs, followed by the
+    // varint gap to every doc (doc - previous doc - 1, from -1) and, with
+    // frequencies, the varint frequency after each gap.
+    class RunWriter {
+    private:
+        std::ofstream file;
+        std::string buffer;
+        int previous_doc;
+
+    public:
+        static constexpr size_t BUFFER_SIZE = size_t(1) << 20;
+
+        explicit RunWriter(const std::string& path) : file(path, std::ios::binary | std::ios::trunc), previous_doc(-1) {
+            if (!file) {
+                throw std::runtime_error("Could not open run file for writing");
+            }
+        }
+
+        void begin_term(std::string_view term, size_t count) {
+            IndexFile::write_varint(buffer, term.size());
+            buffer.append(term.data(), term.size());
+            IndexFile::write_varint(buffer, count);
+            previous_doc = -1;
+        }
+
+        void add(int doc) {
+            IndexFile::write_varint(buffer, static_cast<uint32_t>(doc - previous_doc - 1));
+            previous_doc = doc;
+            if (buffer.size() >= BUFFER_SIZE) flush();
+        }
+
+        void add(int doc, uint32_t frequency) {
+            IndexFile::write_varint(buffer, static_cast<uint32_t>(doc - previous_doc - 1));
+            IndexFile::write_varint(buffer, frequency);
+            previous_doc = doc;
+            if (buffer.size() >= BUFFER_SIZE) flush();
+        }
+
+        void flush() {
+            file.write(buffer.data(), buffer.size());
+            buffer.clear();
+        }
+
+        void close() {
+            flush();
+            file.close();
+            if (!file) {
+                throw std::runtime_error("Could not write run file");
+            }
+        }
+    };
+
+    // Reads a run file sequentially through a fixed buffer. The docs of the
+    // current term must all be read before moving to the next term.
+    class RunReader {
+    private:
+        std::ifstream file;
+        std::vector<char> buffer;
+        size_t position;
+        size_t length;
+        int previous_doc;
+
+        unsigned char read_byte() {
+            if (position == length) {
+                file.read(buffer.data(), buffer.size());
+                length = static_cast<size_t>(file.gcount());
+                position = 0;
+                if (length == 0) {
+                    throw std::runtime_error("Truncated run file");
+                }
+            }
+            return static_cast<unsigned char>(buffer[position++]);
+        }
+
+        bool at_end() {
+            if (position == length) {
+                file.read(buffer.data(), buffer.size());
+                length = static_cast<size_t>(file.gcount());
+                position = 0;
+            }
+            return length == 0;
+        }
+
+        uint64_t read_varint() {
+            uint64_t value = 0;
+            unsigned shift = 0;
+            unsigned char byte;
+            while ((byte = read_byte()) & 0x80) {
+                value |= uint64_t(byte & 0x7F) << shift;
+                shift += 7;
+            }
+            return value | (uint64_t(byte) << shift);
+        }
+
+    public:
+        static constexpr size_t BUFFER_SIZE = size_t(64) << 10;
+
+        std::string term;
+        size_t count;  // Docs of the current term
+        size_t run;    // Position of the run, so that equal terms merge in doc order
+
+        RunReader(const std::string& path, size_t run)
+            : file(path, std::ios::binary), buffer(BUFFER_SIZE), position(0), length(0), previous_doc(-1),
+              count(0), run(run) {
+            if (!file) {
+                throw std::runtime_error("Could not open run file");
+            }
+        }
+
+        // Moves to the next term, returning false at the end of the run
+        bool next_term() {
+            if (at_end()) {
+                return false;
+            }
+            term.resize(read_varint());
+            for (char& c : term) c = static_cast<char>(read_byte());
+            count = read_varint();
+            previous_doc = -1;
+            return true;
+        }
+
+        int next_doc() {
+            previous_doc += static_cast<int>(read_varint()) + 1;
+            return previous_doc;
+        }
+
+        uint32_t next_frequency() {
+            return static_cast<uint32_t>(read_varint());
+        }
+    };
+
+    struct AfterInMerge {
+        bool operator()(const RunReader* a, const RunReader* b) const {
+            return a->term != b->term ? a->term > b->term : a->run > b->run;
+        }
+    };
+
+    std::string filename;
+    size_t memory_budget;
+    bool compress_postings;
+    bool store_frequencies;
+    int current_doc_id;
+    bool finished;
+
+    // Buffered documents, indexed as in Index::add_batch's local builders
+    TermDictionary dictionary;
+    std::vector<std::vector<int>> postings;
+    std::vector<std::vector<uint32_t>> frequencies;
+    size_t postings_bytes;
+
+    std::vector<std::string> runs;
+    size_t next_run;
+    std::string lengths_path;
+    std::ofstream lengths_file;
+
+    std::string temporary_path(const std::string& suffix) const {
+        return filename + "." + suffix + ".tmp";
+    }
+
+    std::string new_run_path() {
+        return temporary_path("run" + std::to_string(next_run++));
+    }
+
+    size_t buffered_bytes() const {
+        return dictionary.memory_usage() + postings_bytes +
+               (postings.capacity() + frequencies.capacity()) * sizeof(std::vector<int>);
+    }
+
+    // Writes the buffered documents to a new run and empties the buffer
+    void spill() {
+        if (dictionary.size() == 0) {
+            return;
+        }
+        std::string path = new_run_path();
+        runs.push_back(path);
+        RunWriter writer(path);
+        for (uint32_t id : dictionary.sorted_ids()) {
+            const auto& docs = postings[id];
+            writer.begin_term(dictionary.term(id), docs.size());
+            for (size_t i = 0; i < docs.size(); ++i) {
+                if (store_frequencies) {
+                    writer.add(docs[i], frequencies[id][i]);
+                } else {
+                    writer.add(docs[i]);
+                }
+            }
+        }
+        writer.close();
+        dictionary = TermDictionary();
+        std::vector<std::vector<int>>().swap(postings);
+        std::vector<std::vector<uint32_t>>().swap(frequencies);
+        postings_bytes = 0;
+    }
+
+    // Merges runs by term, calling f(term, readers) with the readers of every
+    // run holding the term, in run order, positioned on it
+    template <typename F>
+    static void merge(const std::vector<std::string>& paths, F&& f) {
+        std::vector<std::unique_ptr<RunReader>> readers;
+        std::priority_queue<RunReader*, std::vector<RunReader*>, AfterInMerge> heap;
+        for (size_t i = 0; i < paths.size(); ++i) {
+            readers.push_back(std::make_unique<RunReader>(paths[i], i));
+            if (readers.back()->next_term()) heap.push(readers.back().get());
+        }
+        std::vector<RunReader*> current;
+        while (!heap.empty()) {
+            current.clear();
+            current.push_back(heap.top());
+            heap.pop();
+            while (!heap.empty() && heap.top()->term == current[0]->term) {
+                current.push_back(heap.top());
+                heap.pop();
+            }
+            f(current[0]->term, current);
+            for (RunReader* reader : current) {
+                if (reader->next_term()) heap.push(reader);
+            }
+        }
+    }
+
+    // Merges groups of MERGE_FANIN runs until no more than MERGE_FANIN are left
+    void reduce_runs() {
+        while (runs.size() > MERGE_FANIN) {
+            std::vector<std::string> merged;
+            for (size_t begin = 0; begin < runs.size(); begin += MERGE_FANIN) {
+                std::vector<std::string> group(runs.begin() + begin,
+                                               runs.begin() + std::min(begin + MERGE_FANIN, runs.size()));
+                if (group.size() == 1) {
+                    merged.push_back(group[0]);
+                    continue;
+                }
+                std::string path = new_run_path();
+                RunWriter writer(path);
+                merge(group, [&](const std::string& term, const std::vector<RunReader*>& readers) {
+                    size_t count = 0;
+                    for (const RunReader* reader : readers) count += reader->count;
+                    writer.begin_term(term, count);
+                    for (RunReader* reader : readers) {
+                        for (size_t i = 0; i < reader->count; ++i) {
+                            int doc = reader->next_doc();
+                            if (store_frequencies) {
+                                writer.add(doc, reader->next_frequency());
+                            } else {
+                                writer.add(doc);
+                            }
+                        }
+                    }
+                });
+                writer.close();
+                for (const auto& run : group) std::remove(run.c_str());
+                merged.push_back(path);
+            }
+            runs = std::move(merged);
+        }
+    }
+
+    void remove_temporaries() {
+        for (const auto& run : runs) std::remove(run.c_str());
+        runs.clear();
+        if (lengths_file.is_open()) lengths_file.close();
+        std::remove(lengths_path.c_str());
+    }
+
+public:
+    IndexBuilder(const std::string& filename, size_t memory_budget = DEFAULT_MEMORY_BUDGET,
+                 bool compress_postings = true, bool store_frequencies = false)
+        : filename(filename), memory_budget(memory_budget), compress_postings(compress_postings),
+          store_frequencies(store_frequencies), current_doc_id(0), finished(false), postings_bytes(0),
+          next_run(0), lengths_path(temporary_path("lengths")) {
+        if (store_frequencies) {
+            lengths_file.open(lengths_path, std::ios::binary | std::ios::trunc);
+            if (!lengths_file) {
+                throw std::runtime_error("Could not open file for writing");
+            }
+        }
+    }
+
+    ~IndexBuilder() {
+        remove_temporaries();
+    }
+
+    IndexBuilder(const IndexBuilder&) = delete;
+    IndexBuilder& operator=(const IndexBuilder&) = delete;
+
+    // Adds one document, whose words for_each_word(emit) passes one by one to
+    // emit(std::string_view)
+    template <typename ForEachWord>
+    void add_words(ForEachWord&& for_each_word) {
+        if (finished) {
+            throw std::runtime_error("Cannot add documents to a finished index builder");
+        }
+        int doc_id = current_doc_id;
+        uint32_t length = 0;
+        for_each_word([&](std::string_view word) {
+            length++;
+            auto inserted = dictionary.insert(word);
+            if (inserted.second) {
+                postings.emplace_back();
+                if (store_frequencies) frequencies.emplace_back();
+            }
+            auto& docs = postings[inserted.first];
+            if (!docs.empty() && docs.back() == doc_id) {
+                if (store_frequencies) frequencies[inserted.first].back()++;
+                return;
+            }
+            size_t capacity = docs.capacity();
+            docs.push_back(doc_id);
+            postings_bytes += (docs.capacity() - capacity) * sizeof(int);
+            if (store_frequencies) {
+                auto& counts = frequencies[inserted.first];
+                capacity = counts.capacity();
+                counts.push_back(1);
+                postings_bytes += (counts.capacity() - capacity) * sizeof(uint32_t);
+            }
+        });
+        if (store_frequencies) {
+            lengths_file.write(reinterpret_cast<const char*>(&length), sizeof(length));
+        }
+        current_doc_id++;
+        if (buffered_bytes() >= memory_budget) {
+            spill();
+        }
+    }
+
+    void add_document(const std::vector<std::string>& words) {
+        add_words([&](auto&& emit) {
+            for (const auto& word : words) emit(word);
+        });
+    }
+
+    void add_documents(const std::vector<std::vector<std::string>>& documents) {
+        for (const auto& words : documents) add_document(words);
+    }
+
+    void add_text(std::string_view text, const Tokenizer& tokenizer = Tokenizer()) {
+        add_words([&](auto&& emit) { tokenizer.tokenize(text, emit); });
+    }
+
+    // Streams the documents of a file through the tokenizer and returns the
+    // number of documents added. See DocumentReader for the formats. A
+    // malformed line throws with the number of documents added before it.
+    size_t add_file(const std::string& path, DocumentReader::Format format = DocumentReader::Format::Text,
+                    const std::string& field = "text", const Tokenizer& tokenizer = Tokenizer()) {
+        DocumentReader reader(path, format, field);
+        std::string text;
+        size_t total = 0;
+        while (true) {
+            try {
+                if (!reader.next(text)) break;
+            } catch (const std::runtime_error& e) {
+                throw std::runtime_error(e.what() + (" (" + std::to_string(total) + " documents added before it)"));
+            }
+            add_text(text, tokenizer);
+            total++;
+        }
+        return total;
+    }
+
+    // Spills the last documents, merges every run into the index file and
+    // removes the temporary files. No document can be added afterwards.
+    void finish() {
+        if (finished) {
+            throw std::runtime_error("Index builder already finished");
+        }
+        finished = true;
+        spill();
+        reduce_runs();
+
+        std::unique_ptr<MappedFile> lengths;
+        const uint32_t* document_lengths = nullptr;
+        static const uint32_t no_lengths = 0;
+        if (store_frequencies) {
+            lengths_file.close();
+            if (!lengths_file) {
+                throw std::runtime_error("Could not write document lengths");
+            }
+            if (current_doc_id > 0) {
+                lengths = std::make_unique<MappedFile>(lengths_path);
+                document_lengths = reinterpret_cast<const uint32_t*>(lengths->data());
+            } else {
+                document_lengths = &no_lengths;
+            }
+        }
+
+        IndexFileWriter writer(filename, compress_postings, store_frequencies);
+        merge(runs, [&](const std::string& term, const std::vector<RunReader*>& readers) {
+            PostingsList list(compress_postings, store_frequencies);
+            for (RunReader* reader : readers) {
+                for (size_t i = 0; i < reader->count; ++i) {
+                    int doc = reader->next_doc();
+                    if (store_frequencies) {
+                        list.push_back(doc, reader->next_frequency(), document_lengths);
+                    } else {
+                        list.push_back(doc);
+                    }
+                }
+            }
+            writer.add(term, list.view());
+        });
+        writer.finish(current_doc_id, document_lengths);
+        lengths.reset();
+        remove_temporaries();
+    }
+
+    int get_document_count() const {
+        return current_doc_id;
+    }
+
+    // Number of runs spilled so far
+    size_t get_run_count() const {
+        return runs.size();
+    }
+
+    // Memory held by the buffered documents, which spill() keeps under the budget
+    size_t memory_usage() const {
+        return buffered_bytes();
+    }
+};
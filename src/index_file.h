@@ -0,0 +1,588 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <utility>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "postings.h"
+
+// Read-only memory mapping of a whole file. Pages are shared through the page
+// cache by every process mapping the same file.
+class MappedFile {
+private:
+    const char* bytes;
+    size_t length;
+
+public:
+    explicit MappedFile(const std::string& filename) : bytes(nullptr), length(0) {
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("Could not open file for reading");
+        }
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || st.st_size == 0) {
+            ::close(fd);
+            throw std::runtime_error("Could not read index file");
+        }
+        length = static_cast<size_t>(st.st_size);
+        void* address = ::mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (address == MAP_FAILED) {
+            throw std::runtime_error("Could not map index file");
+        }
+        bytes = static_cast<const char*>(address);
+    }
+
+    ~MappedFile() {
+        ::munmap(const_cast<char*>(bytes), length);
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const { return bytes; }
+    size_t size() const { return length; }
+};
+
+// Immutable index file layout (version 4), designed to be used in place:
+//
+//   header | term blocks | term block offsets | term entries | postings
+//   [| document lengths]
+//
+// Terms are sorted and front-coded in blocks of TERMS_PER_BLOCK: the first
+// term of a block is stored whole and every following one as the length of
+// the prefix it shares with its predecessor plus the remaining suffix. Blocks
+// are binary searched on their first term and then scanned. Each term entry
+// points at the skips, packed blocks and raw tail of its postings, which are
+// laid out exactly as in memory. Files with FLAG_FREQUENCIES follow each
+// postings list with its block impacts, packed frequencies and raw tail
+// frequencies, and end with the length of every document.
+//
+// Version 3 is the same layout without frequencies, with a header that ends
+// before lengths_offset.
+class IndexFile {
+public:
+    static constexpr uint32_t MAGIC = 0x43444C45;  // "ELDC"
+    static constexpr uint32_t VERSION = 4;
+    static constexpr uint32_t MIN_MAPPED_VERSION = 3;
+    static constexpr uint32_t FLAG_COMPRESSED = 1;
+    static constexpr uint32_t FLAG_FREQUENCIES = 2;
+    static constexpr size_t TERMS_PER_BLOCK = 16;
+
+    struct Header {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t flags;
+        int32_t document_count;
+        uint64_t term_count;
+        uint64_t terms_offset;
+        uint64_t block_offsets_offset;
+        uint64_t entries_offset;
+        uint64_t postings_offset;
+        uint64_t file_size;
+        // Version 4
+        uint64_t lengths_offset;
+        uint64_t total_length;  // Sum of the document lengths
+    };
+
+    static constexpr size_t VERSION_3_HEADER_SIZE = offsetof(Header, lengths_offset);
+
+    struct TermEntry {
+        uint64_t postings_offset;  // Relative to the postings section
+        uint64_t num_words;
+        uint64_t tail_size;
+        uint32_t num_blocks;
+        uint32_t num_frequency_words;
+    };
+
+    using Term = std::pair<std::string_view, PostingsView>;
+
+    static void write_varint(std::string& out, uint64_t value) {
+        while (value >= 0x80) {
+            out.push_back(static_cast<char>(value | 0x80));
+            value >>= 7;
+        }
+        out.push_back(static_cast<char>(value));
+    }
+
+    // Reads a varint that must end before `end`
+    static uint64_t read_varint(const char*& in, const char* end) {
+        uint64_t value = 0;
+        for (unsigned shift = 0; in < end && shift < 64; shift += 7) {
+            unsigned char byte = static_cast<unsigned char>(*in++);
+            value |= uint64_t(byte & 0x7F) << shift;
+            if (!(byte & 0x80)) {
+                return value;
+            }
+        }
+        throw std::runtime_error("Corrupted index file");
+    }
+
+private:
+    static uint64_t align(uint64_t offset) {
+        return (offset + 7) & ~uint64_t(7);
+    }
+
+    static void pad(std::ostream& file, uint64_t from, uint64_t to) {
+        static const char zeros[8] = {};
+        file.write(zeros, to - from);
+    }
+
+    static uint64_t postings_bytes(const PostingsView& postings, bool frequencies) {
+        uint64_t bytes = postings.num_blocks * sizeof(BlockSkip) + postings.num_words * sizeof(uint32_t) +
+                         postings.tail_size * sizeof(int);
+        if (frequencies) {
+            bytes += postings.num_blocks * sizeof(BlockImpact) +
+                     (postings.num_frequency_words + postings.tail_size) * sizeof(uint32_t);
+        }
+        return bytes;
+    }
+
+public:
+    // Writes `terms`, which must be sorted by term, to a temporary file that is
+    // then renamed over `filename`, so that existing mappings stay valid.
+    // Frequencies are stored when `document_lengths` is given, in which case
+    // every postings view must have them.
+    static void write(const std::string& filename, int document_count, bool compressed,
+                      const std::vector<Term>& terms, const uint32_t* document_lengths = nullptr) {
+        bool frequencies = document_lengths != nullptr;
+        Header header = {};
+        header.magic = MAGIC;
+        header.version = VERSION;
+        header.flags = (compressed ? FLAG_COMPRESSED : 0) | (frequencies ? FLAG_FREQUENCIES : 0);
+        header.document_count = document_count;
+        header.term_count = terms.size();
+
+        std::string term_blocks;
+        std::vector<uint64_t> block_offsets;
+        std::vector<TermEntry> entries(terms.size());
+        uint64_t postings_size = 0;
+        for (size_t i = 0; i < terms.size(); ++i) {
+            encode_term(term_blocks, block_offsets, i, i == 0 ? std::string_view() : terms[i - 1].first,
+                        terms[i].first);
+            entries[i] = make_entry(terms[i].second, frequencies, postings_size);
+        }
+        layout(header, term_blocks.size(), block_offsets.size(), postings_size, document_lengths);
+
+        std::string temporary = filename + ".tmp";
+        std::ofstream file = open(temporary);
+        write_sections(file, header, term_blocks, block_offsets);
+        file.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(TermEntry));
+        pad(file, header.entries_offset + entries.size() * sizeof(TermEntry), header.postings_offset);
+        for (const auto& term : terms) {
+            write_postings(file, term.second, frequencies);
+        }
+        if (frequencies) {
+            file.write(reinterpret_cast<const char*>(document_lengths), size_t(document_count) * sizeof(uint32_t));
+        }
+        commit(file, temporary, filename);
+    }
+
+private:
+    friend class IndexFileWriter;
+
+    // Appends a term to the front-coded term blocks, `previous` being the
+    // term added before it
+    static void encode_term(std::string& term_blocks, std::vector<uint64_t>& block_offsets, size_t i,
+                            std::string_view previous, std::string_view term) {
+        if (i % TERMS_PER_BLOCK == 0) {
+            block_offsets.push_back(term_blocks.size());
+            write_varint(term_blocks, term.size());
+        } else {
+            size_t prefix = 0;
+            size_t limit = std::min(previous.size(), term.size());
+            while (prefix < limit && previous[prefix] == term[prefix]) {
+                prefix++;
+            }
+            write_varint(term_blocks, prefix);
+            write_varint(term_blocks, term.size() - prefix);
+            term = term.substr(prefix);
+        }
+        term_blocks.append(term.data(), term.size());
+    }
+
+    // Entry of postings written at postings_size, which is then advanced past them
+    static TermEntry make_entry(const PostingsView& postings, bool frequencies, uint64_t& postings_size) {
+        if (frequencies && !postings.with_frequencies) {
+            throw std::runtime_error("Missing term frequencies");
+        }
+        TermEntry entry = {postings_size, postings.num_words, postings.tail_size,
+                           static_cast<uint32_t>(postings.num_blocks),
+                           frequencies ? static_cast<uint32_t>(postings.num_frequency_words) : 0};
+        postings_size += postings_bytes(postings, frequencies);
+        return entry;
+    }
+
+    static void write_postings(std::ostream& file, const PostingsView& postings, bool frequencies) {
+        file.write(reinterpret_cast<const char*>(postings.skips), postings.num_blocks * sizeof(BlockSkip));
+        file.write(reinterpret_cast<const char*>(postings.blocks), postings.num_words * sizeof(uint32_t));
+        file.write(reinterpret_cast<const char*>(postings.tail), postings.tail_size * sizeof(int));
+        if (frequencies) {
+            file.write(reinterpret_cast<const char*>(postings.impacts), postings.num_blocks * sizeof(BlockImpact));
+            file.write(reinterpret_cast<const char*>(postings.frequency_blocks),
+                       postings.num_frequency_words * sizeof(uint32_t));
+            file.write(reinterpret_cast<const char*>(postings.tail_frequencies), postings.tail_size * sizeof(uint32_t));
+        }
+    }
+
+    // Fills the offsets of every section of a header whose document_count,
+    // term_count and flags are set
+    static void layout(Header& header, size_t term_blocks_size, size_t num_term_blocks, uint64_t postings_size,
+                       const uint32_t* document_lengths) {
+        header.terms_offset = align(sizeof(Header));
+        header.block_offsets_offset = align(header.terms_offset + term_blocks_size);
+        header.entries_offset = header.block_offsets_offset + num_term_blocks * sizeof(uint64_t);
+        header.postings_offset = align(header.entries_offset + header.term_count * sizeof(TermEntry));
+        header.file_size = header.postings_offset + postings_size;
+        if (header.flags & FLAG_FREQUENCIES) {
+            header.lengths_offset = header.file_size;
+            header.file_size += size_t(header.document_count) * sizeof(uint32_t);
+            for (int doc = 0; doc < header.document_count; ++doc) {
+                header.total_length += document_lengths[doc];
+            }
+        }
+    }
+
+    static std::ofstream open(const std::string& temporary) {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        if (!file) {
+            throw std::runtime_error("Could not open file for writing");
+        }
+        return file;
+    }
+
+    // Writes everything up to the term entries
+    static void write_sections(std::ostream& file, const Header& header, const std::string& term_blocks,
+                               const std::vector<uint64_t>& block_offsets) {
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        pad(file, sizeof(Header), header.terms_offset);
+        file.write(term_blocks.data(), term_blocks.size());
+        pad(file, header.terms_offset + term_blocks.size(), header.block_offsets_offset);
+        file.write(reinterpret_cast<const char*>(block_offsets.data()), block_offsets.size() * sizeof(uint64_t));
+    }
+
+    // Closes a complete temporary file and renames it over filename
+    static void commit(std::ofstream& file, const std::string& temporary, const std::string& filename) {
+        file.close();
+        if (!file || std::rename(temporary.c_str(), filename.c_str()) != 0) {
+            std::remove(temporary.c_str());
+            throw std::runtime_error("Could not write index file");
+        }
+    }
+};
+
+// Writes an index file one term at a time, without ever holding the postings
+// of more than one term. Term entries and postings are spooled to temporary
+// files next to the output and copied after the term blocks by finish(), as
+// the layout puts them last. Terms must be added in lexicographic order.
+class IndexFileWriter {
+private:
+    std::string filename;
+    IndexFile::Header header;
+    std::string term_blocks;
+    std::vector<uint64_t> block_offsets;
+    std::string previous;
+    std::string entries_path;
+    std::string postings_path;
+    std::ofstream entries;
+    std::ofstream postings;
+    uint64_t postings_size;
+
+    static void append(std::ostream& out, const std::string& path) {
+        std::ifstream in(path, std::ios::binary);
+        std::vector<char> buffer(1 << 20);
+        while (in) {
+            in.read(buffer.data(), buffer.size());
+            out.write(buffer.data(), in.gcount());
+        }
+    }
+
+public:
+    IndexFileWriter(const std::string& filename, bool compressed, bool frequencies)
+        : filename(filename), header(), entries_path(filename + ".entries.tmp"),
+          postings_path(filename + ".postings.tmp"), postings_size(0) {
+        header.magic = IndexFile::MAGIC;
+        header.version = IndexFile::VERSION;
+        header.flags = (compressed ? IndexFile::FLAG_COMPRESSED : 0) | (frequencies ? IndexFile::FLAG_FREQUENCIES : 0);
+        entries = IndexFile::open(entries_path);
+        postings = IndexFile::open(postings_path);
+    }
+
+    ~IndexFileWriter() {
+        entries.close();
+        postings.close();
+        std::remove(entries_path.c_str());
+        std::remove(postings_path.c_str());
+    }
+
+    IndexFileWriter(const IndexFileWriter&) = delete;
+    IndexFileWriter& operator=(const IndexFileWriter&) = delete;
+
+    void add(std::string_view term, const PostingsView& view) {
+        if (header.term_count > 0 && term <= previous) {
+            throw std::runtime_error("Terms must be written in increasing order");
+        }
+        bool frequencies = header.flags & IndexFile::FLAG_FREQUENCIES;
+        IndexFile::encode_term(term_blocks, block_offsets, header.term_count, previous, term);
+        IndexFile::TermEntry entry = IndexFile::make_entry(view, frequencies, postings_size);
+        entries.write(reinterpret_cast<const char*>(&entry), sizeof(entry));
+        IndexFile::write_postings(postings, view, frequencies);
+        previous.assign(term);
+        header.term_count++;
+    }
+
+    // Writes the file, renamed over filename once complete. Frequencies need
+    // the length of every document.
+    void finish(int document_count, const uint32_t* document_lengths = nullptr) {
+        entries.close();
+        postings.close();
+        if (!entries || !postings) {
+            throw std::runtime_error("Could not write index file");
+        }
+        header.document_count = document_count;
+        IndexFile::layout(header, term_blocks.size(), block_offsets.size(), postings_size, document_lengths);
+
+        std::string temporary = filename + ".tmp";
+        std::ofstream file = IndexFile::open(temporary);
+        IndexFile::write_sections(file, header, term_blocks, block_offsets);
+        append(file, entries_path);
+        IndexFile::pad(file, header.entries_offset + header.term_count * sizeof(IndexFile::TermEntry),
+                       header.postings_offset);
+        append(file, postings_path);
+        if (header.flags & IndexFile::FLAG_FREQUENCIES) {
+            file.write(reinterpret_cast<const char*>(document_lengths), size_t(document_count) * sizeof(uint32_t));
+        }
+        IndexFile::commit(file, temporary, filename);
+    }
+};
+
+// Index file opened in place: lookups search the front-coded term blocks and
+// return views pointing straight into the mapping. Nothing read from the file
+// is trusted: the term blocks are bounds checked as they are decoded, and the
+// postings of a term are checked in full the first time they are read.
+class MappedIndexFile {
+private:
+    MappedFile file;
+    const IndexFile::Header* header;
+    const char* term_blocks;
+    uint64_t term_blocks_size;
+    const uint64_t* block_offsets;
+    const IndexFile::TermEntry* entries;
+    const char* postings;
+    uint64_t postings_size;
+    size_t num_term_blocks;
+    bool frequencies;
+    // Terms whose postings were checked, set by concurrent readers alike
+    std::unique_ptr<std::atomic<bool>[]> checked;
+
+    const char* block_end(size_t block) const {
+        return term_blocks + (block + 1 < num_term_blocks ? block_offsets[block + 1] : term_blocks_size);
+    }
+
+    // Reads `length` bytes of a term, which must end before `end`
+    static std::string_view read_bytes(const char*& in, const char* end, uint64_t length) {
+        if (length > uint64_t(end - in)) {
+            throw std::runtime_error("Corrupted index file");
+        }
+        std::string_view bytes(in, length);
+        in += length;
+        return bytes;
+    }
+
+    std::string_view first_term(size_t block) const {
+        const char* in = term_blocks + block_offsets[block];
+        const char* end = block_end(block);
+        return read_bytes(in, end, IndexFile::read_varint(in, end));
+    }
+
+    // Decodes the terms of a block in order, calling f(term_id, term) until it
+    // returns false
+    template <typename F>
+    void scan_block(size_t block, std::string& term, F&& f) const {
+        const char* in = term_blocks + block_offsets[block];
+        const char* end = block_end(block);
+        size_t first = block * IndexFile::TERMS_PER_BLOCK;
+        size_t last = std::min(first + IndexFile::TERMS_PER_BLOCK, size_t(header->term_count));
+        for (size_t id = first; id < last; ++id) {
+            if (id == first) {
+                term.assign(read_bytes(in, end, IndexFile::read_varint(in, end)));
+            } else {
+                uint64_t prefix = IndexFile::read_varint(in, end);
+                if (prefix > term.size()) {
+                    throw std::runtime_error("Corrupted index file");
+                }
+                term.resize(prefix);
+                term.append(read_bytes(in, end, IndexFile::read_varint(in, end)));
+            }
+            if (!f(id, std::string_view(term))) return;
+        }
+    }
+
+public:
+    explicit MappedIndexFile(const std::string& filename) : file(filename) {
+        if (file.size() < IndexFile::VERSION_3_HEADER_SIZE) {
+            throw std::runtime_error("Could not read index file");
+        }
+        header = reinterpret_cast<const IndexFile::Header*>(file.data());
+        if (header->magic != IndexFile::MAGIC || header->version < IndexFile::MIN_MAPPED_VERSION ||
+            header->version > IndexFile::VERSION) {
+            throw std::runtime_error("Unsupported index file version");
+        }
+        size_t header_size = header->version == 3 ? IndexFile::VERSION_3_HEADER_SIZE : sizeof(IndexFile::Header);
+        frequencies = header->version > 3 && (header->flags & IndexFile::FLAG_FREQUENCIES);
+        if (file.size() < header_size || header->terms_offset < header_size || header->document_count < 0 ||
+            (frequencies && (header->lengths_offset < header->postings_offset ||
+                             header->lengths_offset + uint64_t(header->document_count) * sizeof(uint32_t) !=
+                                 header->file_size))) {
+            throw std::runtime_error("Corrupted index file");
+        }
+        num_term_blocks = (header->term_count + IndexFile::TERMS_PER_BLOCK - 1) / IndexFile::TERMS_PER_BLOCK;
+        if (header->file_size != file.size() || header->terms_offset > header->block_offsets_offset ||
+            header->block_offsets_offset + num_term_blocks * sizeof(uint64_t) != header->entries_offset ||
+            header->entries_offset + header->term_count * sizeof(IndexFile::TermEntry) > header->postings_offset ||
+            header->postings_offset > file.size()) {
+            throw std::runtime_error("Corrupted index file");
+        }
+        term_blocks = file.data() + header->terms_offset;
+        term_blocks_size = header->block_offsets_offset - header->terms_offset;
+        block_offsets = reinterpret_cast<const uint64_t*>(file.data() + header->block_offsets_offset);
+        entries = reinterpret_cast<const IndexFile::TermEntry*>(file.data() + header->entries_offset);
+        postings = file.data() + header->postings_offset;
+        postings_size = (frequencies ? header->lengths_offset : header->file_size) - header->postings_offset;
+        for (size_t block = 0; block < num_term_blocks; ++block) {
+            if (block_offsets[block] >= term_blocks_size || (block > 0 && block_offsets[block] <= block_offsets[block - 1])) {
+                throw std::runtime_error("Corrupted index file");
+            }
+        }
+        checked.reset(new std::atomic<bool>[header->term_count]());
+    }
+
+    int document_count() const { return header->document_count; }
+    bool is_compressed() const { return header->flags & IndexFile::FLAG_COMPRESSED; }
+    bool has_frequencies() const { return frequencies; }
+    uint64_t total_length() const { return frequencies ? header->total_length : 0; }
+
+    // Length of every document, nullptr without frequencies
+    const uint32_t* document_lengths() const {
+        return frequencies ? reinterpret_cast<const uint32_t*>(file.data() + header->lengths_offset) : nullptr;
+    }
+    size_t term_count() const { return header->term_count; }
+    size_t file_size() const { return file.size(); }
+
+    PostingsView postings_at(size_t i) const {
+        const IndexFile::TermEntry& entry = entries[i];
+        // Bounding every count first keeps the sizes below from overflowing
+        if (entry.postings_offset > postings_size || entry.postings_offset % sizeof(uint32_t) != 0 ||
+            entry.num_words > postings_size || entry.tail_size > postings_size ||
+            (!is_compressed() && entry.num_blocks != 0)) {
+            throw std::runtime_error("Corrupted index file");
+        }
+        const char* data = postings + entry.postings_offset;
+        PostingsView view;
+        view.num_blocks = entry.num_blocks;
+        view.num_words = entry.num_words;
+        view.tail_size = entry.tail_size;
+        size_t docs_size = view.num_blocks * sizeof(BlockSkip) + view.num_words * sizeof(uint32_t) +
+                           view.tail_size * sizeof(int);
+        size_t end = entry.postings_offset + docs_size;
+        if (frequencies) {
+            view.num_frequency_words = entry.num_frequency_words;
+            end += view.num_blocks * sizeof(BlockImpact) + (view.num_frequency_words + view.tail_size) * sizeof(uint32_t);
+        }
+        if (end > postings_size) {
+            throw std::runtime_error("Corrupted index file");
+        }
+        view.skips = reinterpret_cast<const BlockSkip*>(data);
+        view.blocks = reinterpret_cast<const uint32_t*>(data + view.num_blocks * sizeof(BlockSkip));
+        view.tail = reinterpret_cast<const int*>(data + view.num_blocks * sizeof(BlockSkip) +
+                                                 view.num_words * sizeof(uint32_t));
+        if (frequencies) {
+            const char* frequency_data = data + docs_size;
+            view.with_frequencies = true;
+            view.impacts = reinterpret_cast<const BlockImpact*>(frequency_data);
+            view.frequency_blocks = reinterpret_cast<const uint32_t*>(frequency_data + view.num_blocks * sizeof(BlockImpact));
+            view.tail_frequencies = view.frequency_blocks + view.num_frequency_words;
+        }
+        if (!checked[i].load(std::memory_order_acquire)) {
+            if (!view.is_valid(header->document_count)) {
+                throw std::runtime_error("Corrupted index file");
+            }
+            checked[i].store(true, std::memory_order_release);
+        }
+        return view;
+    }
+
+    // Returns an empty view when the word is not in the index
+    PostingsView find(std::string_view word) const {
+        // Last block whose first term is <= word
+        size_t low = 0;
+        size_t high = num_term_blocks;
+        while (low < high) {
+            size_t mid = (low + high) / 2;
+            if (first_term(mid) <= word) low = mid + 1;
+            else high = mid;
+        }
+        if (low == 0) {
+            return PostingsView();
+        }
+        size_t found = SIZE_MAX;
+        std::string term;
+        scan_block(low - 1, term, [&](size_t id, std::string_view t) {
+            if (t == word) found = id;
+            return t < word;
+        });
+        return found == SIZE_MAX ? PostingsView() : postings_at(found);
+    }
+
+    // Calls f(term, postings) for every term starting with prefix, in
+    // lexicographic order
+    template <typename F>
+    void for_each_with_prefix(std::string_view prefix, F&& f) const {
+        // Last block whose first term is < prefix, which may hold the first match
+        size_t low = 0;
+        size_t high = num_term_blocks;
+        while (low < high) {
+            size_t mid = (low + high) / 2;
+            if (first_term(mid) < prefix) low = mid + 1;
+            else high = mid;
+        }
+        std::string term;
+        bool done = false;
+        for (size_t block = low ? low - 1 : 0; block < num_term_blocks && !done; ++block) {
+            scan_block(block, term, [&](size_t id, std::string_view t) {
+                if (t.compare(0, prefix.size(), prefix) > 0) {
+                    done = true;
+                    return false;
+                }
+                if (t.size() >= prefix.size() && t.compare(0, prefix.size(), prefix) == 0) {
+                    f(t, postings_at(id));
+                }
+                return true;
+            });
+        }
+    }
+
+    // Calls f(term, postings) for every term in lexicographic order
+    template <typename F>
+    void for_each(F&& f) const {
+        std::string term;
+        for (size_t block = 0; block < num_term_blocks; ++block) {
+            scan_block(block, term, [&](size_t id, std::string_view t) {
+                f(t, postings_at(id));
+                return true;
+            });
+        }
+    }
+};
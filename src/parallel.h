@@ -0,0 +1,61 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Number of worker threads to use when the caller asks for 0
+inline size_t default_thread_count() {
+    size_t count = std::thread::hardware_concurrency();
+    return count ? count : 1;
+}
+
+// Calls f(i) for every i in [0, n) on a pool of num_threads workers (0 for one
+// per core). Workers pull indices from a shared counter, so slow items do not
+// hold back the others. The first exception thrown by f is rethrown once every
+// worker has stopped.
+template <typename F>
+void parallel_for(size_t n, size_t num_threads, F&& f) {
+    if (num_threads == 0) {
+        num_threads = default_thread_count();
+    }
+    num_threads = std::min(num_threads, n);
+    if (num_threads <= 1) {
+        for (size_t i = 0; i < n; ++i) {
+            f(i);
+        }
+        return;
+    }
+
+    std::atomic<size_t> next(0);
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    auto worker = [&]() {
+        for (size_t i = next++; i < n; i = next++) {
+            try {
+                f(i);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (!error) error = std::current_exception();
+                next = n;
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    workers.reserve(num_threads - 1);
+    for (size_t t = 1; t < num_threads; ++t) {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : workers) {
+        thread.join();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
@@ -0,0 +1,421 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <algorithm>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Bit-packing codec for blocks of BLOCK_SIZE doc id gaps.
+//
+// Values are laid out vertically over 4 lanes (value i goes to lane i % 4), so
+// each group of 4 consecutive values is unpacked with a single 128-bit shift
+// and mask, and the prefix sum that turns gaps back into doc ids runs 4 values
+// at a time.
+class BlockCodec {
+public:
+    static constexpr size_t BLOCK_SIZE = 128;
+    static constexpr size_t LANES = 4;
+
+    // Number of 32-bit words used by a packed block of the given bit width
+    static size_t packed_words(unsigned bits) {
+        return LANES * bits;
+    }
+
+    static unsigned required_bits(const uint32_t* values) {
+        uint32_t acc = 0;
+        for (size_t i = 0; i < BLOCK_SIZE; ++i) {
+            acc |= values[i];
+        }
+        unsigned bits = 0;
+        while (acc) {
+            bits++;
+            acc >>= 1;
+        }
+        return bits;
+    }
+
+    static void pack(const uint32_t* values, unsigned bits, uint32_t* out) {
+        std::fill(out, out + packed_words(bits), 0u);
+        if (bits == 0) return;
+        for (size_t j = 0; j < BLOCK_SIZE / LANES; ++j) {
+            size_t bit_offset = j * bits;
+            size_t word = bit_offset / 32;
+            unsigned shift = bit_offset % 32;
+            for (size_t lane = 0; lane < LANES; ++lane) {
+                uint32_t value = values[j * LANES + lane];
+                out[word * LANES + lane] |= value << shift;
+                if (shift + bits > 32) {
+                    out[(word + 1) * LANES + lane] |= value >> (32 - shift);
+                }
+            }
+        }
+    }
+
+    // Decodes a packed block of gaps into doc ids. Each stored gap is
+    // (doc - previous_doc - 1), with `base` being the doc preceding the block.
+    static void decode(const uint32_t* in, unsigned bits, int base, int* out) {
+#if defined(__SSE2__)
+        const __m128i mask = _mm_set1_epi32(bits == 32 ? -1 : static_cast<int>((1u << bits) - 1));
+        const __m128i one = _mm_set1_epi32(1);
+        __m128i prev = _mm_set1_epi32(base);
+        const __m128i* words = reinterpret_cast<const __m128i*>(in);
+        for (size_t j = 0; j < BLOCK_SIZE / LANES; ++j) {
+            __m128i gaps = _mm_setzero_si128();
+            if (bits) {
+                size_t bit_offset = j * bits;
+                size_t word = bit_offset / 32;
+                unsigned shift = bit_offset % 32;
+                gaps = _mm_srl_epi32(_mm_loadu_si128(words + word), _mm_cvtsi32_si128(shift));
+                if (shift + bits > 32) {
+                    __m128i high = _mm_loadu_si128(words + word + 1);
+                    gaps = _mm_or_si128(gaps, _mm_sll_epi32(high, _mm_cvtsi32_si128(32 - shift)));
+                }
+                gaps = _mm_and_si128(gaps, mask);
+            }
+            // Inclusive prefix sum of (gap + 1) over the 4 lanes
+            __m128i v = _mm_add_epi32(gaps, one);
+            v = _mm_add_epi32(v, _mm_slli_si128(v, 4));
+            v = _mm_add_epi32(v, _mm_slli_si128(v, 8));
+            v = _mm_add_epi32(v, prev);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + j * LANES), v);
+            prev = _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 3, 3, 3));
+        }
+#else
+        const uint32_t mask = bits == 32 ? 0xFFFFFFFFu : ((1u << bits) - 1);
+        int prev = base;
+        for (size_t j = 0; j < BLOCK_SIZE / LANES; ++j) {
+            size_t bit_offset = j * bits;
+            size_t word = bit_offset / 32;
+            unsigned shift = bit_offset % 32;
+            for (size_t lane = 0; lane < LANES; ++lane) {
+                uint32_t gap = 0;
+                if (bits) {
+                    gap = in[word * LANES + lane] >> shift;
+                    if (shift + bits > 32) {
+                        gap |= in[(word + 1) * LANES + lane] << (32 - shift);
+                    }
+                    gap &= mask;
+                }
+                prev += static_cast<int>(gap) + 1;
+                out[j * LANES + lane] = prev;
+            }
+        }
+#endif
+    }
+
+    // Unpacks a packed block of plain values, without any prefix sum
+    static void unpack(const uint32_t* in, unsigned bits, uint32_t* out) {
+#if defined(__SSE2__)
+        const __m128i mask = _mm_set1_epi32(bits == 32 ? -1 : static_cast<int>((1u << bits) - 1));
+        const __m128i* words = reinterpret_cast<const __m128i*>(in);
+        for (size_t j = 0; j < BLOCK_SIZE / LANES; ++j) {
+            __m128i values = _mm_setzero_si128();
+            if (bits) {
+                size_t bit_offset = j * bits;
+                size_t word = bit_offset / 32;
+                unsigned shift = bit_offset % 32;
+                values = _mm_srl_epi32(_mm_loadu_si128(words + word), _mm_cvtsi32_si128(shift));
+                if (shift + bits > 32) {
+                    __m128i high = _mm_loadu_si128(words + word + 1);
+                    values = _mm_or_si128(values, _mm_sll_epi32(high, _mm_cvtsi32_si128(32 - shift)));
+                }
+                values = _mm_and_si128(values, mask);
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + j * LANES), values);
+        }
+#else
+        const uint32_t mask = bits == 32 ? 0xFFFFFFFFu : ((1u << bits) - 1);
+        for (size_t j = 0; j < BLOCK_SIZE / LANES; ++j) {
+            size_t bit_offset = j * bits;
+            size_t word = bit_offset / 32;
+            unsigned shift = bit_offset % 32;
+            for (size_t lane = 0; lane < LANES; ++lane) {
+                uint32_t value = 0;
+                if (bits) {
+                    value = in[word * LANES + lane] >> shift;
+                    if (shift + bits > 32) {
+                        value |= in[(word + 1) * LANES + lane] << (32 - shift);
+                    }
+                    value &= mask;
+                }
+                out[j * LANES + lane] = value;
+            }
+        }
+#endif
+    }
+};
+
+struct BlockSkip {
+    int32_t last_doc;  // Last doc id stored in the block
+    uint32_t offset;   // Position of the block in the packed words
+};
+
+// Term frequencies of a block, summarized for ranking: no doc of the block
+// occurs more than max_frequency times or is shorter than min_length
+struct BlockImpact {
+    uint32_t offset;  // Position of the block in the packed frequency words
+    uint32_t max_frequency;
+    uint32_t min_length;
+};
+
+// Read-only view of a postings list, pointing either into a PostingsList or
+// into a memory-mapped index file. The tail holds the doc ids that do not fill
+// a whole block. Term frequencies, when stored, follow the same layout: one
+// packed block of (frequency - 1) values per doc block, and a raw tail.
+struct PostingsView {
+    const BlockSkip* skips = nullptr;
+    const uint32_t* blocks = nullptr;
+    const int* tail = nullptr;
+    size_t num_blocks = 0;
+    size_t num_words = 0;
+    size_t tail_size = 0;
+
+    bool with_frequencies = false;
+    const BlockImpact* impacts = nullptr;
+    const uint32_t* frequency_blocks = nullptr;
+    const uint32_t* tail_frequencies = nullptr;
+    size_t num_frequency_words = 0;
+
+    size_t size() const { return num_blocks * BlockCodec::BLOCK_SIZE + tail_size; }
+    bool empty() const { return size() == 0; }
+
+    int block_last_doc(size_t block) const { return skips[block].last_doc; }
+
+    // Decodes BLOCK_SIZE doc ids of the given block into `out`
+    void decode_block(size_t block, int* out) const {
+        const uint32_t* data = blocks + skips[block].offset;
+        int base = block == 0 ? -1 : skips[block - 1].last_doc;
+        BlockCodec::decode(data + 1, data[0], base, out);
+    }
+
+    // Decodes the BLOCK_SIZE term frequencies of the given block into `out`
+    void decode_frequencies(size_t block, uint32_t* out) const {
+        const uint32_t* data = frequency_blocks + impacts[block].offset;
+        BlockCodec::unpack(data + 1, data[0], out);
+        for (size_t i = 0; i < BlockCodec::BLOCK_SIZE; ++i) {
+            out[i]++;
+        }
+    }
+
+    std::vector<uint32_t> decode_frequencies() const {
+        std::vector<uint32_t> result(size());
+        for (size_t b = 0; b < num_blocks; ++b) {
+            decode_frequencies(b, result.data() + b * BlockCodec::BLOCK_SIZE);
+        }
+        std::copy(tail_frequencies, tail_frequencies + tail_size, result.begin() + num_blocks * BlockCodec::BLOCK_SIZE);
+        return result;
+    }
+
+    std::vector<int> decode() const {
+        std::vector<int> result(size());
+        for (size_t b = 0; b < num_blocks; ++b) {
+            decode_block(b, result.data() + b * BlockCodec::BLOCK_SIZE);
+        }
+        std::copy(tail, tail + tail_size, result.begin() + num_blocks * BlockCodec::BLOCK_SIZE);
+        return result;
+    }
+
+    // Whether a view read from a file can be used safely: every packed block
+    // lies within its words with a bit width of at most 32, and the doc ids
+    // decode to a strictly increasing sequence, matching the skips, of ids
+    // below document_count. Decodes every block.
+    bool is_valid(int document_count) const {
+        int docs[BlockCodec::BLOCK_SIZE];
+        int previous = -1;
+        for (size_t b = 0; b < num_blocks; ++b) {
+            if (!is_packed_block(blocks, num_words, skips[b].offset) ||
+                (with_frequencies && !is_packed_block(frequency_blocks, num_frequency_words, impacts[b].offset))) {
+                return false;
+            }
+            decode_block(b, docs);
+            for (int doc : docs) {
+                if (doc <= previous) return false;
+                previous = doc;
+            }
+            if (previous != skips[b].last_doc) return false;
+        }
+        for (size_t i = 0; i < tail_size; ++i) {
+            if (tail[i] <= previous) return false;
+            previous = tail[i];
+        }
+        return previous < document_count;
+    }
+
+private:
+    static bool is_packed_block(const uint32_t* words, size_t num_words, size_t offset) {
+        return offset < num_words && words[offset] <= 32 &&
+               BlockCodec::packed_words(words[offset]) < num_words - offset;
+    }
+};
+
+// Sorted list of doc ids for one term.
+//
+// When compressed, every full run of BlockCodec::BLOCK_SIZE doc ids is
+// delta-encoded and bit-packed, and only the trailing partial block is kept as
+// raw ints. A block is stored as its bit width followed by its packed words,
+// and a skip entry per block allows jumping over blocks without decoding them.
+// When not compressed, every doc id stays in the raw tail.
+//
+// Lists created with frequencies also keep the number of occurrences of the
+// term in each doc, packed alongside the doc ids, with the impact of every
+// block so that ranking can bound the scores of a block without decoding it.
+class PostingsList {
+private:
+    struct Frequencies {
+        std::vector<BlockImpact> impacts;
+        std::vector<uint32_t> blocks;
+        std::vector<uint32_t> tail;
+    };
+
+    bool compressed;
+    std::vector<BlockSkip> skips;
+    std::vector<uint32_t> blocks;
+    std::vector<int> tail;
+    // Kept apart so that lists without frequencies stay small
+    std::unique_ptr<Frequencies> frequencies;
+
+    void flush_frequencies(const uint32_t* document_lengths) {
+        uint32_t values[BlockCodec::BLOCK_SIZE];
+        BlockImpact impact = {static_cast<uint32_t>(frequencies->blocks.size()), 0, UINT32_MAX};
+        for (size_t i = 0; i < BlockCodec::BLOCK_SIZE; ++i) {
+            uint32_t frequency = frequencies->tail[i];
+            values[i] = frequency - 1;
+            impact.max_frequency = std::max(impact.max_frequency, frequency);
+            impact.min_length = std::min(impact.min_length, document_lengths[tail[i]]);
+        }
+        unsigned bits = BlockCodec::required_bits(values);
+        frequencies->blocks.resize(impact.offset + 1 + BlockCodec::packed_words(bits));
+        frequencies->blocks[impact.offset] = bits;
+        BlockCodec::pack(values, bits, frequencies->blocks.data() + impact.offset + 1);
+        frequencies->impacts.push_back(impact);
+        frequencies->tail.clear();
+    }
+
+    void flush_tail() {
+        uint32_t gaps[BlockCodec::BLOCK_SIZE];
+        int prev = skips.empty() ? -1 : skips.back().last_doc;
+        for (size_t i = 0; i < BlockCodec::BLOCK_SIZE; ++i) {
+            gaps[i] = static_cast<uint32_t>(tail[i] - prev - 1);
+            prev = tail[i];
+        }
+        unsigned bits = BlockCodec::required_bits(gaps);
+        size_t offset = blocks.size();
+        blocks.resize(offset + 1 + BlockCodec::packed_words(bits));
+        blocks[offset] = bits;
+        BlockCodec::pack(gaps, bits, blocks.data() + offset + 1);
+        skips.push_back({tail.back(), static_cast<uint32_t>(offset)});
+        tail.clear();
+    }
+
+public:
+    explicit PostingsList(bool compressed = true, bool with_frequencies = false)
+        : compressed(compressed), frequencies(with_frequencies ? std::make_unique<Frequencies>() : nullptr) {}
+
+    void push_back(int doc_id) {
+        tail.push_back(doc_id);
+        if (compressed && tail.size() == BlockCodec::BLOCK_SIZE) {
+            flush_tail();
+        }
+    }
+
+    // Appends a doc to a list with frequencies. `document_lengths` is indexed
+    // by doc id and must already hold the length of this doc.
+    void push_back(int doc_id, uint32_t frequency, const uint32_t* document_lengths) {
+        tail.push_back(doc_id);
+        frequencies->tail.push_back(frequency);
+        if (compressed && tail.size() == BlockCodec::BLOCK_SIZE) {
+            flush_frequencies(document_lengths);
+            flush_tail();
+        }
+    }
+
+    bool empty() const { return skips.empty() && tail.empty(); }
+    size_t size() const { return skips.size() * BlockCodec::BLOCK_SIZE + tail.size(); }
+    bool is_compressed() const { return compressed; }
+    bool has_frequencies() const { return frequencies != nullptr; }
+
+    int back() const {
+        return tail.empty() ? skips.back().last_doc : tail.back();
+    }
+
+    PostingsView view() const {
+        PostingsView v;
+        v.skips = skips.data();
+        v.blocks = blocks.data();
+        v.tail = tail.data();
+        v.num_blocks = skips.size();
+        v.num_words = blocks.size();
+        v.tail_size = tail.size();
+        if (frequencies) {
+            v.with_frequencies = true;
+            v.impacts = frequencies->impacts.data();
+            v.frequency_blocks = frequencies->blocks.data();
+            v.tail_frequencies = frequencies->tail.data();
+            v.num_frequency_words = frequencies->blocks.size();
+        }
+        return v;
+    }
+
+    std::vector<int> decode() const {
+        return view().decode();
+    }
+
+    size_t memory_usage() const {
+        size_t total = skips.capacity() * sizeof(BlockSkip) + blocks.capacity() * sizeof(uint32_t) +
+                       tail.capacity() * sizeof(int);
+        if (frequencies) {
+            total += sizeof(Frequencies) + frequencies->impacts.capacity() * sizeof(BlockImpact) +
+                     (frequencies->blocks.capacity() + frequencies->tail.capacity()) * sizeof(uint32_t);
+        }
+        return total;
+    }
+
+    // Reads a postings list in the version 1 file layout
+    static PostingsList read(std::istream& in, bool compressed) {
+        uint64_t sizes[3];
+        in.read(reinterpret_cast<char*>(sizes), sizeof(sizes));
+        if (sizes[1] * BlockCodec::BLOCK_SIZE > sizes[0] || (!compressed && sizes[1] != 0)) {
+            throw std::runtime_error("Corrupted postings list");
+        }
+        PostingsList list(compressed);
+        list.skips.resize(sizes[1]);
+        list.blocks.resize(sizes[2]);
+        list.tail.resize(sizes[0] - sizes[1] * BlockCodec::BLOCK_SIZE);
+        in.read(reinterpret_cast<char*>(list.skips.data()), list.skips.size() * sizeof(BlockSkip));
+        in.read(reinterpret_cast<char*>(list.blocks.data()), list.blocks.size() * sizeof(uint32_t));
+        in.read(reinterpret_cast<char*>(list.tail.data()), list.tail.size() * sizeof(int));
+        return list;
+    }
+
+    static PostingsList from_view(const PostingsView& v, bool compressed) {
+        if (!compressed && v.num_blocks != 0) {
+            throw std::runtime_error("Corrupted postings list");
+        }
+        PostingsList list(compressed, v.with_frequencies);
+        list.skips.assign(v.skips, v.skips + v.num_blocks);
+        list.blocks.assign(v.blocks, v.blocks + v.num_words);
+        list.tail.assign(v.tail, v.tail + v.tail_size);
+        if (v.with_frequencies) {
+            list.frequencies->impacts.assign(v.impacts, v.impacts + v.num_blocks);
+            list.frequencies->blocks.assign(v.frequency_blocks, v.frequency_blocks + v.num_frequency_words);
+            list.frequencies->tail.assign(v.tail_frequencies, v.tail_frequencies + v.tail_size);
+        }
+        return list;
+    }
+
+    static PostingsList from_sorted(const std::vector<int>& docs, bool compressed) {
+        PostingsList list(compressed);
+        for (int doc : docs) {
+            list.push_back(doc);
+        }
+        return list;
+    }
+};
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include "query_tree.h"
+#include "query_stats.h"
+
+// Thread-safe LRU cache of parsed queries keyed by query string and
+// ignore_case. Parsing happens outside the lock, so concurrent misses on the
+// same query may parse it twice, but never block each other.
+class QueryCache {
+private:
+    using Entry = std::pair<std::string, std::shared_ptr<const QueryTree>>;
+
+    size_t capacity;
+    std::list<Entry> entries;  // Most recently used first
+    std::unordered_map<std::string, std::list<Entry>::iterator> positions;
+    std::mutex mutex;
+
+    static std::string make_key(const std::string& query_string, bool ignore_case) {
+        return (ignore_case ? '1' : '0') + query_string;
+    }
+
+    static std::shared_ptr<const QueryTree> parse(const std::string& query_string, bool ignore_case) {
+        auto timer = QueryStats::Timer::parse();
+        return std::make_shared<const QueryTree>(query_string, ignore_case);
+    }
+
+    void evict() {
+        while (entries.size() > capacity) {
+            positions.erase(entries.back().first);
+            entries.pop_back();
+        }
+    }
+
+public:
+    explicit QueryCache(size_t capacity = 1024) : capacity(capacity) {}
+
+    std::shared_ptr<const QueryTree> get(const std::string& query_string, bool ignore_case) {
+        if (capacity == 0) {
+            return parse(query_string, ignore_case);
+        }
+        std::string key = make_key(query_string, ignore_case);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = positions.find(key);
+            if (it != positions.end()) {
+                entries.splice(entries.begin(), entries, it->second);
+                return it->second->second;
+            }
+        }
+
+        auto tree = parse(query_string, ignore_case);
+        std::lock_guard<std::mutex> lock(mutex);
+        if (positions.find(key) == positions.end()) {
+            entries.emplace_front(key, tree);
+            positions.emplace(std::move(key), entries.begin());
+            evict();
+        }
+        return tree;
+    }
+
+    void set_capacity(size_t new_capacity) {
+        std::lock_guard<std::mutex> lock(mutex);
+        capacity = new_capacity;
+        evict();
+    }
+
+    size_t size() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return entries.size();
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lock(mutex);
+        entries.clear();
+        positions.clear();
+    }
+};
@@ -0,0 +1,292 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <utility>
+#include "postings.h"
+#include "query_tree.h"
+
+enum class PlanOp { Empty, All, Term, And, Or, Not };
+
+// Node of a normalized query plan. AND and OR are n-ary; an AND intersects its
+// children and subtracts its excluded operands, so that NOT only remains where
+// a complement against the whole collection cannot be avoided.
+struct PlanNode {
+    PlanOp op;
+    std::string word;
+    PostingsView postings;
+    size_t estimate = 0;  // Upper bound on the number of matching docs
+    std::vector<std::unique_ptr<PlanNode>> children;
+    std::vector<std::unique_ptr<PlanNode>> excluded;
+    std::string key;  // Canonical form of the node, empty until assignKeys()
+
+    explicit PlanNode(PlanOp o) : op(o) {}
+
+    std::string toString() const {
+        switch (op) {
+            case PlanOp::Empty: return "<none>";
+            case PlanOp::All: return "<all>";
+            case PlanOp::Term: return word;
+            case PlanOp::Not: return "NOT " + children[0]->toString();
+            case PlanOp::And:
+            case PlanOp::Or: {
+                std::string result = "(";
+                for (size_t i = 0; i < children.size(); ++i) {
+                    if (i > 0) result += op == PlanOp::And ? " AND " : " OR ";
+                    result += children[i]->toString();
+                }
+                for (const auto& child : excluded) {
+                    result += " AND NOT " + child->toString();
+                }
+                return result + ")";
+            }
+        }
+        return "";
+    }
+
+    // Sets the key of every node of the tree, bottom up so that each key is
+    // built once from those of its operands. Nodes matching the same docs by
+    // construction get the same key: AND and OR operands and excluded
+    // operands are sorted, as their order does not matter. Words are
+    // length-prefixed, so that any bytes can appear.
+    void assignKeys() {
+        switch (op) {
+            case PlanOp::Empty: key = "0"; return;
+            case PlanOp::All: key = "*"; return;
+            case PlanOp::Term: key = std::to_string(word.size()) + ":" + word; return;
+            case PlanOp::Not:
+                children[0]->assignKeys();
+                key = "!(" + children[0]->key + ")";
+                return;
+            case PlanOp::And:
+            case PlanOp::Or: {
+                auto append_sorted = [this](const std::vector<std::unique_ptr<PlanNode>>& nodes) {
+                    std::vector<const std::string*> keys;
+                    keys.reserve(nodes.size());
+                    for (const auto& node : nodes) {
+                        node->assignKeys();
+                        keys.push_back(&node->key);
+                    }
+                    auto by_key = [](const std::string* a, const std::string* b) { return *a < *b; };
+                    // Operands of patterns come in term order already
+                    if (!std::is_sorted(keys.begin(), keys.end(), by_key)) {
+                        std::sort(keys.begin(), keys.end(), by_key);
+                    }
+                    for (const std::string* operand : keys) {
+                        key += *operand;
+                        key += ',';
+                    }
+                };
+                key = op == PlanOp::And ? "&(" : "|(";
+                append_sorted(children);
+                if (!excluded.empty()) {
+                    key += '-';
+                    append_sorted(excluded);
+                }
+                key += ')';
+                return;
+            }
+        }
+    }
+};
+
+// Turns a QueryTree into a PlanNode tree: chains of the same operator are
+// flattened, AND NOT becomes a difference, negations are pushed through
+// De Morgan's laws, and AND operands are ordered rarest first.
+class QueryPlanner {
+public:
+    // Returns an empty view for unknown words
+    using PostingsLookup = std::function<PostingsView(const std::string&)>;
+    // Returns every indexed term matching the pattern, with its postings
+    using PatternLookup = std::function<std::vector<std::pair<std::string, PostingsView>>(std::string_view)>;
+
+private:
+    PostingsLookup lookup;
+    PatternLookup pattern_lookup;
+    size_t universe_size;
+
+    static std::unique_ptr<PlanNode> make(PlanOp op, size_t estimate) {
+        auto node = std::make_unique<PlanNode>(op);
+        node->estimate = estimate;
+        return node;
+    }
+
+    std::unique_ptr<PlanNode> build(const QueryTree& tree, uint32_t index) const {
+        const FlatQueryNode& node = tree.getNode(index);
+        switch (node.op) {
+            case QueryOp::Pattern: {
+                // A single OR over every matching term, however many there are
+                auto result = make(PlanOp::Or, 0);
+                for (auto& match : pattern_lookup(tree.getWord(index))) {
+                    auto term = make(PlanOp::Term, match.second.size());
+                    term->word = std::move(match.first);
+                    term->postings = match.second;
+                    result->children.push_back(std::move(term));
+                }
+                return finish_or(std::move(result));
+            }
+            case QueryOp::Word: {
+                std::string word(tree.getWord(index));
+                PostingsView postings = lookup(word);
+                if (postings.empty()) {
+                    return make(PlanOp::Empty, 0);
+                }
+                auto term = make(PlanOp::Term, postings.size());
+                term->word = std::move(word);
+                term->postings = postings;
+                return term;
+            }
+            case QueryOp::Not:
+                return negate(build(tree, node.left));
+            case QueryOp::And: {
+                auto result = make(PlanOp::And, 0);
+                add_conjunct(*result, build(tree, node.left));
+                add_conjunct(*result, build(tree, node.right));
+                return finish_and(std::move(result));
+            }
+            case QueryOp::Or: {
+                auto result = make(PlanOp::Or, 0);
+                add_disjunct(*result, build(tree, node.left));
+                add_disjunct(*result, build(tree, node.right));
+                return finish_or(std::move(result));
+            }
+            case QueryOp::AndNot: {
+                auto result = make(PlanOp::And, 0);
+                add_conjunct(*result, build(tree, node.left));
+                add_excluded(*result, build(tree, node.right));
+                return finish_and(std::move(result));
+            }
+        }
+        throw std::runtime_error("Unknown node type");
+    }
+
+    std::unique_ptr<PlanNode> negate(std::unique_ptr<PlanNode> node) const {
+        switch (node->op) {
+            case PlanOp::Not: return std::move(node->children[0]);
+            case PlanOp::Empty: return make(PlanOp::All, universe_size);
+            case PlanOp::All: return make(PlanOp::Empty, 0);
+            default: break;
+        }
+        auto result = make(PlanOp::Not, universe_size - std::min(universe_size, node->estimate));
+        result->children.push_back(std::move(node));
+        return result;
+    }
+
+    void add_conjunct(PlanNode& target, std::unique_ptr<PlanNode> node) const {
+        if (node->op == PlanOp::And) {
+            for (auto& child : node->children) add_conjunct(target, std::move(child));
+            for (auto& child : node->excluded) add_excluded(target, std::move(child));
+        } else if (node->op == PlanOp::Not) {
+            add_excluded(target, std::move(node->children[0]));
+        } else {
+            target.children.push_back(std::move(node));
+        }
+    }
+
+    void add_excluded(PlanNode& target, std::unique_ptr<PlanNode> node) const {
+        if (node->op == PlanOp::Or) {
+            // a AND NOT (b OR c) == a AND NOT b AND NOT c
+            for (auto& child : node->children) add_excluded(target, std::move(child));
+        } else if (node->op == PlanOp::Not) {
+            add_conjunct(target, std::move(node->children[0]));
+        } else {
+            target.excluded.push_back(std::move(node));
+        }
+    }
+
+    void add_disjunct(PlanNode& target, std::unique_ptr<PlanNode> node) const {
+        if (node->op == PlanOp::Or) {
+            for (auto& child : node->children) add_disjunct(target, std::move(child));
+        } else {
+            target.children.push_back(std::move(node));
+        }
+    }
+
+    static bool contains_op(const std::vector<std::unique_ptr<PlanNode>>& nodes, PlanOp op) {
+        return std::any_of(nodes.begin(), nodes.end(), [op](const auto& n) { return n->op == op; });
+    }
+
+    static void remove_op(std::vector<std::unique_ptr<PlanNode>>& nodes, PlanOp op) {
+        nodes.erase(std::remove_if(nodes.begin(), nodes.end(), [op](const auto& n) { return n->op == op; }),
+                    nodes.end());
+    }
+
+    std::unique_ptr<PlanNode> finish_and(std::unique_ptr<PlanNode> node) const {
+        if (contains_op(node->children, PlanOp::Empty) || contains_op(node->excluded, PlanOp::All)) {
+            return make(PlanOp::Empty, 0);
+        }
+        remove_op(node->children, PlanOp::All);
+        remove_op(node->excluded, PlanOp::Empty);
+
+        if (node->children.empty()) {
+            // NOT a AND NOT b == NOT (a OR b)
+            if (node->excluded.empty()) {
+                return make(PlanOp::All, universe_size);
+            }
+            auto disjunction = make(PlanOp::Or, 0);
+            for (auto& child : node->excluded) add_disjunct(*disjunction, std::move(child));
+            return negate(finish_or(std::move(disjunction)));
+        }
+
+        std::stable_sort(node->children.begin(), node->children.end(),
+                         [](const auto& a, const auto& b) { return a->estimate < b->estimate; });
+        std::stable_sort(node->excluded.begin(), node->excluded.end(),
+                         [](const auto& a, const auto& b) { return a->estimate > b->estimate; });
+
+        if (node->children.size() == 1 && node->excluded.empty()) {
+            return std::move(node->children[0]);
+        }
+        node->estimate = node->children[0]->estimate;
+        return node;
+    }
+
+    std::unique_ptr<PlanNode> finish_or(std::unique_ptr<PlanNode> node) const {
+        if (contains_op(node->children, PlanOp::All)) {
+            return make(PlanOp::All, universe_size);
+        }
+        remove_op(node->children, PlanOp::Empty);
+        if (node->children.empty()) {
+            return make(PlanOp::Empty, 0);
+        }
+
+        if (contains_op(node->children, PlanOp::Not)) {
+            // a OR NOT b == NOT (b AND NOT a), so the only complement left is
+            // the outer one, which an enclosing AND turns into a difference
+            auto conjunction = make(PlanOp::And, 0);
+            for (auto& child : node->children) {
+                if (child->op == PlanOp::Not) {
+                    add_conjunct(*conjunction, std::move(child->children[0]));
+                } else {
+                    add_excluded(*conjunction, std::move(child));
+                }
+            }
+            return negate(finish_and(std::move(conjunction)));
+        }
+
+        if (node->children.size() == 1) {
+            return std::move(node->children[0]);
+        }
+        size_t estimate = 0;
+        for (const auto& child : node->children) {
+            estimate += child->estimate;
+        }
+        node->estimate = std::min(estimate, universe_size);
+        return node;
+    }
+
+public:
+    QueryPlanner(PostingsLookup lookup, PatternLookup pattern_lookup, size_t universe_size)
+        : lookup(std::move(lookup)), pattern_lookup(std::move(pattern_lookup)), universe_size(universe_size) {}
+
+    std::unique_ptr<PlanNode> plan(const QueryTree& query_tree) const {
+        return build(query_tree, query_tree.getRootIndex());
+    }
+
+    // Plan of the subtree rooted at the node at index
+    std::unique_ptr<PlanNode> plan(const QueryTree& query_tree, uint32_t index) const {
+        return build(query_tree, index);
+    }
+};
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+#include "doc_cursor.h"
+
+// Statistics of one node of a query plan, as reported by Index::explain()
+// (plan only) and Index::profile() (plan and evaluation)
+struct QueryProfile {
+    std::string op;          // AND, OR, NOT, TERM, ALL or EMPTY
+    std::string word;        // For TERM
+    std::string algorithm;   // How the node is evaluated
+    size_t postings = 0;     // Length of the postings list of a TERM
+    size_t estimate = 0;     // Planner's upper bound on the number of matches
+    size_t excluded = 0;     // Number of AND NOT operands, the last children
+    // Filled by profile() only
+    size_t output = 0;       // Distinct docs the node's cursor landed on
+    size_t calls = 0;        // Calls to next() and advance()
+    double seconds = 0;      // Wall time in the node, its children included
+    size_t bytes = 0;        // Memory allocated to evaluate the node itself
+    std::vector<QueryProfile> children;
+
+    std::string to_json() const {
+        std::string result = "{\"op\": " + quote(op);
+        if (!word.empty()) result += ", \"word\": " + quote(word);
+        result += ", \"algorithm\": " + quote(algorithm) + ", \"postings\": " + std::to_string(postings) +
+                  ", \"estimate\": " + std::to_string(estimate) + ", \"excluded\": " + std::to_string(excluded) +
+                  ", \"output\": " + std::to_string(output) + ", \"calls\": " + std::to_string(calls);
+        char seconds_text[32];
+        std::snprintf(seconds_text, sizeof(seconds_text), "%.9f", seconds);
+        result += std::string(", \"seconds\": ") + seconds_text + ", \"bytes\": " + std::to_string(bytes) +
+                  ", \"children\": [";
+        for (size_t i = 0; i < children.size(); ++i) {
+            if (i > 0) result += ", ";
+            result += children[i].to_json();
+        }
+        return result + "]}";
+    }
+
+private:
+    static std::string quote(const std::string& text) {
+        std::string result = "\"";
+        for (char c : text) {
+            if (c == '"' || c == '\\') {
+                result += '\\';
+                result += c;
+            } else if (static_cast<unsigned char>(c) < 0x20) {
+                char escaped[8];
+                std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                result += escaped;
+            } else {
+                result += c;
+            }
+        }
+        return result + "\"";
+    }
+};
+
+// Forwards to a cursor and records its calls, time and output in a profile
+class ProfilingCursor : public DocCursor {
+private:
+    using Clock = std::chrono::steady_clock;
+
+    std::unique_ptr<DocCursor> cursor;
+    QueryProfile& profile;
+    int last;
+
+    int record(int doc, Clock::time_point start) {
+        profile.seconds += std::chrono::duration<double>(Clock::now() - start).count();
+        profile.calls++;
+        if (doc != last && doc != END) profile.output++;
+        return last = doc;
+    }
+
+public:
+    ProfilingCursor(std::unique_ptr<DocCursor> cursor, QueryProfile& profile)
+        : cursor(std::move(cursor)), profile(profile), last(-1) {}
+
+    int doc() const override { return cursor->doc(); }
+    int next() override {
+        auto start = Clock::now();
+        return record(cursor->next(), start);
+    }
+    int advance(int target) override {
+        auto start = Clock::now();
+        return record(cursor->advance(target), start);
+    }
+    size_t cost() const override { return cursor->cost(); }
+};
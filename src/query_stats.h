@@ -0,0 +1,94 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <initializer_list>
+
+// Process-wide query counters, off by default. Each query, parse or postings
+// cursor adds to them once with a relaxed atomic addition, so that they can
+// stay enabled under concurrent searches.
+class QueryStats {
+public:
+    struct Counters {
+        uint64_t queries = 0;           // Query evaluations, one per index (or segment) searched
+        uint64_t parses = 0;            // Query strings parsed, i.e. query cache misses
+        uint64_t parse_nanos = 0;
+        uint64_t evaluate_nanos = 0;
+        uint64_t postings_scanned = 0;  // Doc ids decoded from postings lists
+    };
+
+private:
+    std::atomic<bool> enabled{false};
+    std::atomic<uint64_t> queries{0};
+    std::atomic<uint64_t> parses{0};
+    std::atomic<uint64_t> parse_nanos{0};
+    std::atomic<uint64_t> evaluate_nanos{0};
+    std::atomic<uint64_t> postings_scanned{0};
+
+    QueryStats() = default;
+
+public:
+    static QueryStats& global() {
+        static QueryStats stats;
+        return stats;
+    }
+
+    bool is_enabled() const { return enabled.load(std::memory_order_relaxed); }
+    void set_enabled(bool value) { enabled.store(value, std::memory_order_relaxed); }
+
+    void add_postings_scanned(uint64_t count) {
+        if (is_enabled()) postings_scanned.fetch_add(count, std::memory_order_relaxed);
+    }
+
+    Counters get() const {
+        Counters counters;
+        counters.queries = queries.load(std::memory_order_relaxed);
+        counters.parses = parses.load(std::memory_order_relaxed);
+        counters.parse_nanos = parse_nanos.load(std::memory_order_relaxed);
+        counters.evaluate_nanos = evaluate_nanos.load(std::memory_order_relaxed);
+        counters.postings_scanned = postings_scanned.load(std::memory_order_relaxed);
+        return counters;
+    }
+
+    void reset() {
+        for (auto* counter : {&queries, &parses, &parse_nanos, &evaluate_nanos, &postings_scanned}) {
+            counter->store(0, std::memory_order_relaxed);
+        }
+    }
+
+    // Counts one parse or one query evaluation and its duration, from
+    // construction to destruction, when the counters are enabled
+    class Timer {
+    private:
+        std::atomic<uint64_t>* count;
+        std::atomic<uint64_t>* nanos;
+        std::chrono::steady_clock::time_point start;
+
+        Timer(std::atomic<uint64_t>& count, std::atomic<uint64_t>& nanos, bool enabled)
+            : count(enabled ? &count : nullptr), nanos(&nanos) {
+            if (enabled) start = std::chrono::steady_clock::now();
+        }
+
+    public:
+        static Timer parse() {
+            QueryStats& stats = global();
+            return Timer(stats.parses, stats.parse_nanos, stats.is_enabled());
+        }
+
+        static Timer evaluate() {
+            QueryStats& stats = global();
+            return Timer(stats.queries, stats.evaluate_nanos, stats.is_enabled());
+        }
+
+        Timer(const Timer&) = delete;
+        Timer& operator=(const Timer&) = delete;
+
+        ~Timer() {
+            if (!count) return;
+            auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+            count->fetch_add(1, std::memory_order_relaxed);
+            nanos->fetch_add(static_cast<uint64_t>(elapsed.count()), std::memory_order_relaxed);
+        }
+    };
+};
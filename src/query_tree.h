@@ -1,389 +1,550 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <memory>
 #include <vector>
-#include <regex>
 #include <stdexcept>
 #include <algorithm>
 #include <cctype>
 #include <sstream>
 #include <iostream>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+
+enum class QueryOp : uint8_t { Word, Pattern, Not, And, Or, AndNot };
+
+// One node of a QueryTree. A Word or Pattern holds the id of its term in
+// `left`, a Not its child in `left`, and a binary node both its children.
+struct FlatQueryNode {
+    QueryOp op;
+    uint32_t left;
+    uint32_t right;
+};
+
+// Glob-style word patterns: '*' matches any run of characters and '?'
+// exactly one character
+struct WordPattern {
+    static bool isPattern(std::string_view word) {
+        return word.find_first_of("*?") != std::string_view::npos;
+    }
+
+    // Characters before the first wildcard, shared by every matching term
+    static std::string_view prefix(std::string_view pattern) {
+        return pattern.substr(0, std::min(pattern.size(), pattern.find_first_of("*?")));
+    }
+
+    static bool matches(std::string_view pattern, std::string_view term) {
+        size_t i = 0, j = 0;
+        size_t star = std::string_view::npos, mark = 0;
+        while (j < term.size()) {
+            if (i < pattern.size() && pattern[i] == '?') {
+                i++;
+                j = next_char(term, j);
+            } else if (i < pattern.size() && pattern[i] == '*') {
+                star = i++;
+                mark = j;
+            } else if (i < pattern.size() && pattern[i] == term[j]) {
+                i++;
+                j++;
+            } else if (star != std::string_view::npos) {
+                // Let the last '*' take one more character
+                i = star + 1;
+                mark = next_char(term, mark);
+                j = mark;
+            } else {
+                return false;
+            }
+        }
+        while (i < pattern.size() && pattern[i] == '*') i++;
+        return i == pattern.size();
+    }
+
+private:
+    static size_t next_char(std::string_view text, size_t i) {
+        i++;
+        while (i < text.size() && (static_cast<unsigned char>(text[i]) & 0xC0) == 0x80) i++;
+        return i;
+    }
+};
 
+class QueryTree;
+
+// Read-only view of one node of a QueryTree, as handed out by
+// QueryTree::getRoot() to the Python API. Valid as long as its tree.
 class QueryNode {
+protected:
+    const QueryTree* tree;
+    uint32_t index;
 public:
+    QueryNode(const QueryTree* tree, uint32_t index) : tree(tree), index(index) {}
     virtual ~QueryNode() = default;
-    virtual std::string toString() const = 0;
-    virtual std::string toStringFlattenedORs() const { return toString(); }
+    std::string toString() const;
+    std::string toStringFlattenedORs() const;
+    uint32_t getIndex() const { return index; }
 };
 
 class WordNode : public QueryNode {
-private:
-    std::string word;
 public:
-    WordNode(const std::string& w) : word(w) {}
-    std::string toString() const override { return word; }
-    std::string toStringFlattenedORs() const override { return word; }
-    const std::string& getWord() const { return word; }  // Add this line
+    using QueryNode::QueryNode;
+    std::string getWord() const;
+};
+
+// Word with wildcards, standing for every indexed term it matches
+class PatternNode : public WordNode {
+public:
+    using WordNode::WordNode;
+    std::string_view prefix() const;
+    bool matches(std::string_view term) const;
 };
 
 class NotNode : public QueryNode {
-private:
-    std::unique_ptr<QueryNode> child;
 public:
-    NotNode(std::unique_ptr<QueryNode> c) : child(std::move(c)) {}
-    std::string toString() const override { return "NOT " + child->toString(); }
-    std::string toStringFlattenedORs() const override { return "NOT " + child->toStringFlattenedORs(); }
-    const QueryNode* getChild() const { return child.get(); }
+    using QueryNode::QueryNode;
+    const QueryNode* getChild() const;
 };
 
 class BinaryOpNode : public QueryNode {
-protected:
-    std::unique_ptr<QueryNode> left;
-    std::unique_ptr<QueryNode> right;
-    std::string op;
 public:
-    BinaryOpNode(std::unique_ptr<QueryNode> l, std::unique_ptr<QueryNode> r, const std::string& o)
-        : left(std::move(l)), right(std::move(r)), op(o) {}
-    std::string toString() const override {
-        return "(" + left->toString() + " " + op + " " + right->toString() + ")";
-    }
-    const QueryNode* getLeft() const { return left.get(); }
-    const QueryNode* getRight() const { return right.get(); }
+    using QueryNode::QueryNode;
+    const QueryNode* getLeft() const;
+    const QueryNode* getRight() const;
 };
 
 class AndNode : public BinaryOpNode {
 public:
-    AndNode(std::unique_ptr<QueryNode> l, std::unique_ptr<QueryNode> r)
-        : BinaryOpNode(std::move(l), std::move(r), "AND") {}
-    std::string toStringFlattenedORs() const override {
-        return "(" + left->toStringFlattenedORs() + " AND " + right->toStringFlattenedORs() + ")";
-    }
+    using BinaryOpNode::BinaryOpNode;
 };
 
 class OrNode : public BinaryOpNode {
 public:
-    OrNode(std::unique_ptr<QueryNode> l, std::unique_ptr<QueryNode> r)
-        : BinaryOpNode(std::move(l), std::move(r), "OR") {}
-    std::string toStringFlattenedORs() const override {
-        std::vector<std::string> terms;
-        flattenOR(terms);
-        return "(" + join(terms, " OR ") + ")";
-    }
-
-private:
-    void flattenOR(std::vector<std::string>& terms) const {
-        if (auto orLeft = dynamic_cast<const OrNode*>(left.get())) {
-            orLeft->flattenOR(terms);
-        } else {
-            terms.push_back(left->toStringFlattenedORs());
-        }
-        if (auto orRight = dynamic_cast<const OrNode*>(right.get())) {
-            orRight->flattenOR(terms);
-        } else {
-            terms.push_back(right->toStringFlattenedORs());
-        }
-    }
-
-    static std::string join(const std::vector<std::string>& v, const std::string& delim) {
-        std::string result;
-        for (size_t i = 0; i < v.size(); ++i) {
-            if (i > 0) result += delim;
-            result += v[i];
-        }
-        return result;
-    }
+    using BinaryOpNode::BinaryOpNode;
 };
 
 class AndNotNode : public BinaryOpNode {
 public:
-    AndNotNode(std::unique_ptr<QueryNode> l, std::unique_ptr<QueryNode> r)
-        : BinaryOpNode(std::move(l), std::move(r), "AND NOT") {}
-    std::string toStringFlattenedORs() const override {
-        return "(" + left->toStringFlattenedORs() + " AND NOT " + right->toStringFlattenedORs() + ")";
-    }
+    using BinaryOpNode::BinaryOpNode;
+};
+
+// Error raised for malformed queries, with the offset of the offending
+// character in the query string
+class QueryParseError : public std::runtime_error {
+private:
+    size_t position;
+public:
+    QueryParseError(const std::string& message, size_t pos)
+        : std::runtime_error(message + " at position " + std::to_string(pos)), position(pos) {}
+    size_t getPosition() const { return position; }
 };
 
+// A parsed query, stored flat: nodes live in one vector and refer to their
+// children and terms by index, and every distinct term is stored once. A copy
+// thus copies three arrays, and an expansion only appends the nodes on the
+// path to its leaf, sharing the rest of the tree. Nodes are never modified
+// once appended, so nodes replaced by expand() stay behind, unreachable.
 class QueryTree {
 private:
-    std::unique_ptr<QueryNode> root;
+    friend class QueryParser;
+
+    std::vector<FlatQueryNode> nodes;
+    std::vector<uint32_t> term_offsets{0};
+    std::string term_chars;
+    uint32_t root = 0;
+    // Views handed out by getRoot(), one per node, created on demand
+    mutable std::vector<std::unique_ptr<QueryNode>> views;
+    mutable std::mutex views_mutex;
+
+    uint32_t addTerm(std::string_view term) {
+        term_chars.append(term);
+        term_offsets.push_back(static_cast<uint32_t>(term_chars.size()));
+        return static_cast<uint32_t>(term_offsets.size() - 2);
+    }
 
-    static std::string strip_brackets(const std::string& s) {
-        if (s.front() == '(' && s.back() == ')' && is_balanced(s.substr(1, s.length() - 2))) {
-            return s.substr(1, s.length() - 2);
+    uint32_t internTerm(std::string_view term) {
+        for (uint32_t id = 0; id < numTerms(); ++id) {
+            if (getTerm(id) == term) return id;
         }
-        return s;
+        return addTerm(term);
     }
 
-    static bool is_balanced(const std::string& s) {
-        int count = 0;
-        for (char c : s) {
-            if (c == '(') count++;
-            if (c == ')') count--;
-            if (count < 0) return false;
-        }
-        return count == 0;
+    uint32_t addNode(QueryOp op, uint32_t left, uint32_t right) {
+        nodes.push_back({op, left, right});
+        return static_cast<uint32_t>(nodes.size() - 1);
+    }
+
+    static QueryOp parseOp(const std::string& op) {
+        if (op == "AND") return QueryOp::And;
+        if (op == "OR") return QueryOp::Or;
+        if (op == "AND NOT") return QueryOp::AndNot;
+        throw std::runtime_error("Invalid operator for expansion");
     }
 
-    static std::unique_ptr<QueryNode> parse_query(const std::string& query, bool ignore_case = true) {
-        std::string q = strip_brackets(query);
+    static bool isBinary(QueryOp op) {
+        return op == QueryOp::And || op == QueryOp::Or || op == QueryOp::AndNot;
+    }
 
-        if (q.empty()) {
-            throw std::runtime_error("Empty query");
+    static const char* opName(QueryOp op) {
+        switch (op) {
+            case QueryOp::And: return "AND";
+            case QueryOp::Or: return "OR";
+            case QueryOp::AndNot: return "AND NOT";
+            default: return "";
         }
+    }
 
-        if (q.front() == '"' && q.back() == '"' && std::count(q.begin(), q.end(), '"') == 2) {
-            if (ignore_case) {
-                std::transform(q.begin(), q.end(), q.begin(), ::tolower);
+    // Appends a copy of the node at index with the node at the end of path
+    // (relative to it) replaced by (node op word), and returns its index
+    uint32_t expandAt(uint32_t index, const std::vector<int>& path, size_t pathIndex, uint32_t word, QueryOp op) {
+        if (pathIndex == path.size()) {
+            return addNode(op, index, addNode(QueryOp::Word, word, 0));
+        }
+        FlatQueryNode node = nodes[index];
+        if (isBinary(node.op)) {
+            if (path[pathIndex] == 0) {
+                node.left = expandAt(node.left, path, pathIndex + 1, word, op);
+            } else if (path[pathIndex] == 1) {
+                node.right = expandAt(node.right, path, pathIndex + 1, word, op);
             }
-            return std::make_unique<WordNode>(q.substr(1, q.length() - 2));
+        } else if (node.op == QueryOp::Not) {
+            node.left = expandAt(node.left, path, pathIndex + 1, word, op);
+        } else {
+            throw std::runtime_error("Invalid path for expansion");
         }
+        return addNode(node.op, node.left, node.right);
+    }
 
-        if (q.substr(0, 4) == "NOT " || q.substr(0, 4) == "not ") {
-            return std::make_unique<NotNode>(parse_query(q.substr(4), ignore_case));
+    // Paths of the leaves, each as the indices of the nodes from the root down
+    void collectLeafPaths(uint32_t index, std::vector<uint32_t>& path, std::vector<std::vector<uint32_t>>& paths) const {
+        path.push_back(index);
+        const FlatQueryNode& node = nodes[index];
+        if (node.op == QueryOp::Word || node.op == QueryOp::Pattern) {
+            paths.push_back(path);
+        } else if (node.op == QueryOp::Not) {
+            collectLeafPaths(node.left, path, paths);
+        } else {
+            collectLeafPaths(node.left, path, paths);
+            collectLeafPaths(node.right, path, paths);
         }
+        path.pop_back();
+    }
 
-        std::regex op_regex(R"(\s+(AND NOT|AND|OR)\s+)");
-        std::sregex_iterator it(q.begin(), q.end(), op_regex);
-        std::sregex_iterator end;
-
-        std::string left_part = q;
-        std::string op;
-        std::string right_part;
-
-        for (; it != end; ++it) {
-            std::smatch match = *it;
-            left_part = q.substr(0, match.position());
-            op = match.str();
-            right_part = q.substr(match.position() + match.length());
-
-            if (is_balanced(left_part) && is_balanced(right_part)) {
-                break;
+    void appendOrOperands(uint32_t index, std::string& out, bool& first) const {
+        for (uint32_t child : {nodes[index].left, nodes[index].right}) {
+            if (nodes[child].op == QueryOp::Or) {
+                appendOrOperands(child, out, first);
+            } else {
+                if (!first) out += " OR ";
+                out += toString(child, true);
+                first = false;
             }
         }
+    }
 
-        if (op.empty()) {
-            if (ignore_case) {
-                std::transform(q.begin(), q.end(), q.begin(), ::tolower);
-            }
-            return std::make_unique<WordNode>(q);
-        }
+public:
+    QueryTree(const std::string& query, bool ignore_case = true);
+
+    QueryTree(const QueryTree& other)
+        : nodes(other.nodes), term_offsets(other.term_offsets), term_chars(other.term_chars), root(other.root) {}
+
+    QueryTree(QueryTree&& other) noexcept
+        : nodes(std::move(other.nodes)), term_offsets(std::move(other.term_offsets)),
+          term_chars(std::move(other.term_chars)), root(other.root) {}
+
+    QueryTree& operator=(QueryTree other) {
+        nodes = std::move(other.nodes);
+        term_offsets = std::move(other.term_offsets);
+        term_chars = std::move(other.term_chars);
+        root = other.root;
+        std::lock_guard<std::mutex> lock(views_mutex);
+        views.clear();
+        return *this;
+    }
 
-        op = op.substr(1, op.length() - 2);
-        std::transform(op.begin(), op.end(), op.begin(), ::tolower);
+    uint32_t getRootIndex() const { return root; }
+    const FlatQueryNode& getNode(uint32_t index) const { return nodes[index]; }
+    // Number of nodes stored, unreachable ones included
+    size_t numNodes() const { return nodes.size(); }
 
-        if (op == "or") {
-            return std::make_unique<OrNode>(parse_query(left_part, ignore_case), parse_query(right_part, ignore_case));
-        } else if (op == "and") {
-            return std::make_unique<AndNode>(parse_query(left_part, ignore_case), parse_query(right_part, ignore_case));
-        } else if (op == "and not") {
-            return std::make_unique<AndNotNode>(parse_query(left_part, ignore_case), parse_query(right_part, ignore_case));
-        }
+    size_t numTerms() const { return term_offsets.size() - 1; }
+    std::string_view getTerm(uint32_t id) const {
+        return std::string_view(term_chars).substr(term_offsets[id], term_offsets[id + 1] - term_offsets[id]);
+    }
+    // Term of a Word or Pattern node
+    std::string_view getWord(uint32_t index) const { return getTerm(nodes[index].left); }
 
-        throw std::runtime_error("Invalid operator");
+    std::string toString(bool flattened = true) const {
+        return nodes.empty() ? "" : toString(root, flattened);
     }
 
-    static std::unique_ptr<QueryNode> cloneNode(const QueryNode* node) {
-        if (const auto* wordNode = dynamic_cast<const WordNode*>(node)) {
-            return std::make_unique<WordNode>(wordNode->getWord());
-        } else if (const auto* notNode = dynamic_cast<const NotNode*>(node)) {
-            return std::make_unique<NotNode>(cloneNode(notNode->getChild()));
-        } else if (const auto* andNode = dynamic_cast<const AndNode*>(node)) {
-            return std::make_unique<AndNode>(cloneNode(andNode->getLeft()), cloneNode(andNode->getRight()));
-        } else if (const auto* orNode = dynamic_cast<const OrNode*>(node)) {
-            return std::make_unique<OrNode>(cloneNode(orNode->getLeft()), cloneNode(orNode->getRight()));
-        } else if (const auto* andNotNode = dynamic_cast<const AndNotNode*>(node)) {
-            return std::make_unique<AndNotNode>(cloneNode(andNotNode->getLeft()), cloneNode(andNotNode->getRight()));
+    std::string toString(uint32_t index, bool flattened) const {
+        const FlatQueryNode& node = nodes[index];
+        switch (node.op) {
+            case QueryOp::Word:
+            case QueryOp::Pattern:
+                return std::string(getTerm(node.left));
+            case QueryOp::Not:
+                return "NOT " + toString(node.left, flattened);
+            case QueryOp::Or:
+                if (flattened) {
+                    std::string result = "(";
+                    bool first = true;
+                    appendOrOperands(index, result, first);
+                    return result + ")";
+                }
+                break;
+            default:
+                break;
         }
-        throw std::runtime_error("Unknown node type");
+        return "(" + toString(node.left, flattened) + " " + opName(node.op) + " " + toString(node.right, flattened) + ")";
     }
 
-    static std::unique_ptr<QueryNode> expandNodeAt(
-        const QueryNode* node,
-        const std::vector<int>& path,
-        size_t pathIndex,
-        const std::string& newWord,
-        const std::string& op
-    ) {
-        if (pathIndex == path.size()) {
-            if (op == "AND") {
-                return std::make_unique<AndNode>(
-                    cloneNode(node),
-                    std::make_unique<WordNode>(newWord)
-                );
-            } else if (op == "OR") {
-                return std::make_unique<OrNode>(
-                    cloneNode(node),
-                    std::make_unique<WordNode>(newWord)
-                );
-            } else if (op == "AND NOT") {
-                return std::make_unique<AndNotNode>(
-                    cloneNode(node),
-                    std::make_unique<WordNode>(newWord)
-                );
-            } else {
-                throw std::runtime_error("Invalid operator for expansion");
+    std::string toStringFlattenedORs() const {
+        return toString(true);
+    }
+
+    void expand(const std::vector<int>& path, const std::string& newWord, const std::string& op = "AND") {
+        QueryOp binary = parseOp(op);
+        root = expandAt(root, path, 0, internTerm(newWord), binary);
+    }
+
+    // Every tree obtained by replacing one leaf x by (x AND newWord),
+    // (x OR newWord) or (x AND NOT newWord), leaves from left to right
+    std::vector<QueryTree> generateAllExpansions(const std::string& newWord) const {
+        std::vector<std::vector<uint32_t>> leafPaths;
+        std::vector<uint32_t> path;
+        collectLeafPaths(root, path, leafPaths);
+
+        QueryTree base(*this);
+        uint32_t word = base.internTerm(newWord);
+        std::vector<QueryTree> expansions;
+        expansions.reserve(leafPaths.size() * 3);
+        for (const auto& leafPath : leafPaths) {
+            for (QueryOp op : {QueryOp::And, QueryOp::Or, QueryOp::AndNot}) {
+                QueryTree tree(base);
+                tree.nodes.reserve(tree.nodes.size() + leafPath.size() + 2);
+                uint32_t replaced = leafPath.back();
+                uint32_t current = tree.addNode(op, replaced, tree.addNode(QueryOp::Word, word, 0));
+                // Copy the ancestors of the leaf, bottom up
+                for (size_t i = leafPath.size() - 1; i-- > 0;) {
+                    FlatQueryNode parent = tree.nodes[leafPath[i]];
+                    if (parent.left == replaced) {
+                        parent.left = current;
+                    } else {
+                        parent.right = current;
+                    }
+                    replaced = leafPath[i];
+                    current = tree.addNode(parent.op, parent.left, parent.right);
+                }
+                tree.root = current;
+                expansions.push_back(std::move(tree));
             }
         }
+        return expansions;
+    }
 
-        if (const auto* binaryNode = dynamic_cast<const BinaryOpNode*>(node)) {
-            auto newLeft = (path[pathIndex] == 0) 
-                ? expandNodeAt(binaryNode->getLeft(), path, pathIndex + 1, newWord, op)
-                : cloneNode(binaryNode->getLeft());
-            auto newRight = (path[pathIndex] == 1)
-                ? expandNodeAt(binaryNode->getRight(), path, pathIndex + 1, newWord, op)
-                : cloneNode(binaryNode->getRight());
-
-            if (dynamic_cast<const AndNode*>(binaryNode)) {
-                return std::make_unique<AndNode>(std::move(newLeft), std::move(newRight));
-            } else if (dynamic_cast<const OrNode*>(binaryNode)) {
-                return std::make_unique<OrNode>(std::move(newLeft), std::move(newRight));
-            } else if (dynamic_cast<const AndNotNode*>(binaryNode)) {
-                return std::make_unique<AndNotNode>(std::move(newLeft), std::move(newRight));
+    // View of a node, for the Python API; the index reads nodes through
+    // getNode() instead
+    const QueryNode* view(uint32_t index) const {
+        std::lock_guard<std::mutex> lock(views_mutex);
+        if (views.size() < nodes.size()) {
+            views.resize(nodes.size());
+        }
+        auto& node_view = views[index];
+        if (!node_view) {
+            switch (nodes[index].op) {
+                case QueryOp::Word: node_view = std::make_unique<WordNode>(this, index); break;
+                case QueryOp::Pattern: node_view = std::make_unique<PatternNode>(this, index); break;
+                case QueryOp::Not: node_view = std::make_unique<NotNode>(this, index); break;
+                case QueryOp::And: node_view = std::make_unique<AndNode>(this, index); break;
+                case QueryOp::Or: node_view = std::make_unique<OrNode>(this, index); break;
+                case QueryOp::AndNot: node_view = std::make_unique<AndNotNode>(this, index); break;
             }
-        } else if (const auto* notNode = dynamic_cast<const NotNode*>(node)) {
-            return std::make_unique<NotNode>(
-                expandNodeAt(notNode->getChild(), path, pathIndex + 1, newWord, op)
-            );
         }
+        return node_view.get();
+    }
+
+    const QueryNode* getRoot() const { return view(root); }
 
-        // We shouldn't reach here if the path is valid
-        throw std::runtime_error("Invalid path for expansion");
+    std::string repr() const {
+        return "QueryTree(\"" + toString() + "\")";
     }
+};
 
-    void generateExpansionsRecursive(const QueryNode* node, const std::string& newWord, 
-                                     std::vector<int>& currentPath,
-                                     std::vector<std::tuple<std::unique_ptr<QueryNode>, std::vector<int>, std::string>>& expansions) const {
-        // Expand at the current node only if it's a binary node or the root
-        if (currentPath.empty() || dynamic_cast<const BinaryOpNode*>(node)) {
-            for (const auto& op : {"AND", "OR", "AND NOT"}) {
-                expansions.emplace_back(expandNodeAt(root.get(), currentPath, 0, newWord, op), currentPath, op);
-            }
-        }
+// Single-pass parser for the query language:
+//
+//   expression := "NOT" expression | operand [operator expression]
+//   operand    := "(" expression ")" | '"' text '"' | word { word }
+//   operator   := "AND NOT" | "AND" | "OR"
+//
+// Operators are upper case and all share the same precedence, binding to the
+// right, and a leading NOT applies to the whole expression that follows it.
+// Consecutive words that are not operators form a single multi-word term, and
+// an unquoted term with '*' or '?' is a pattern. Nodes are appended to the
+// tree as they are parsed, children first.
+class QueryParser {
+private:
+    const std::string& query;
+    size_t pos;
+    bool ignore_case;
+    QueryTree& tree;
+    std::unordered_map<std::string, uint32_t> term_ids;
+
+    static bool is_space(char c) {
+        return std::isspace(static_cast<unsigned char>(c)) != 0;
+    }
 
-        // Recursively traverse children
-        if (const auto* binaryNode = dynamic_cast<const BinaryOpNode*>(node)) {
-            currentPath.push_back(0);
-            generateExpansionsRecursive(binaryNode->getLeft(), newWord, currentPath, expansions);
-            currentPath.back() = 1;
-            generateExpansionsRecursive(binaryNode->getRight(), newWord, currentPath, expansions);
-            currentPath.pop_back();
-        } else if (const auto* notNode = dynamic_cast<const NotNode*>(node)) {
-            currentPath.push_back(0);
-            generateExpansionsRecursive(notNode->getChild(), newWord, currentPath, expansions);
-            currentPath.pop_back();
-        }
+    bool at_boundary(size_t i) const {
+        return i >= query.size() || is_space(query[i]) || query[i] == '(' || query[i] == ')' || query[i] == '"';
     }
-    
-    void collectWordNodePaths(const QueryNode* node, std::vector<int>& currentPath, std::vector<std::vector<int>>& paths) const {
-        if (dynamic_cast<const WordNode*>(node)) {
-            paths.push_back(currentPath);
-        } else if (const auto* binaryNode = dynamic_cast<const BinaryOpNode*>(node)) {
-            currentPath.push_back(0);
-            collectWordNodePaths(binaryNode->getLeft(), currentPath, paths);
-            currentPath.pop_back();
-
-            currentPath.push_back(1);
-            collectWordNodePaths(binaryNode->getRight(), currentPath, paths);
-            currentPath.pop_back();
-        } else if (const auto* notNode = dynamic_cast<const NotNode*>(node)) {
-            currentPath.push_back(0);
-            collectWordNodePaths(notNode->getChild(), currentPath, paths);
-            currentPath.pop_back();
-        }
+
+    // Whether the keyword starts at i and ends on a word boundary
+    bool at_keyword(size_t i, const char* keyword) const {
+        size_t length = std::char_traits<char>::length(keyword);
+        return query.compare(i, length, keyword) == 0 && at_boundary(i + length);
     }
 
-    std::unique_ptr<QueryNode> cloneAndReplaceAtPath(const QueryNode* node, const std::vector<int>& path, size_t pathIndex, const std::string& newWord, const std::string& op) const {
-        if (pathIndex == path.size()) {
-            if (const auto* wordNode = dynamic_cast<const WordNode*>(node)) {
-                // Replace the WordNode with a BinaryOpNode
-                auto leftNode = cloneNode(wordNode);
-                auto rightNode = std::make_unique<WordNode>(newWord);
-                if (op == "AND") {
-                    return std::make_unique<AndNode>(std::move(leftNode), std::move(rightNode));
-                } else if (op == "OR") {
-                    return std::make_unique<OrNode>(std::move(leftNode), std::move(rightNode));
-                } else if (op == "AND NOT") {
-                    return std::make_unique<AndNotNode>(std::move(leftNode), std::move(rightNode));
-                } else {
-                    throw std::runtime_error("Invalid operator");
-                }
-            } else {
-                throw std::runtime_error("Expected WordNode at the end of path");
-            }
-        } else {
-            if (const auto* binaryNode = dynamic_cast<const BinaryOpNode*>(node)) {
-                std::unique_ptr<QueryNode> newLeft, newRight;
-                if (path[pathIndex] == 0) {
-                    newLeft = cloneAndReplaceAtPath(binaryNode->getLeft(), path, pathIndex + 1, newWord, op);
-                    newRight = cloneNode(binaryNode->getRight());
-                } else {
-                    newLeft = cloneNode(binaryNode->getLeft());
-                    newRight = cloneAndReplaceAtPath(binaryNode->getRight(), path, pathIndex + 1, newWord, op);
-                }
-                if (dynamic_cast<const AndNode*>(binaryNode)) {
-                    return std::make_unique<AndNode>(std::move(newLeft), std::move(newRight));
-                } else if (dynamic_cast<const OrNode*>(binaryNode)) {
-                    return std::make_unique<OrNode>(std::move(newLeft), std::move(newRight));
-                } else if (dynamic_cast<const AndNotNode*>(binaryNode)) {
-                    return std::make_unique<AndNotNode>(std::move(newLeft), std::move(newRight));
-                } else {
-                    throw std::runtime_error("Unknown binary node type");
-                }
-            } else if (const auto* notNode = dynamic_cast<const NotNode*>(node)) {
-                auto newChild = cloneAndReplaceAtPath(notNode->getChild(), path, pathIndex + 1, newWord, op);
-                return std::make_unique<NotNode>(std::move(newChild));
-            } else {
-                throw std::runtime_error("Unexpected node type in path");
+    void skip_spaces() {
+        while (pos < query.size() && is_space(query[pos])) pos++;
+    }
+
+    size_t skip_spaces_from(size_t i) const {
+        while (i < query.size() && is_space(query[i])) i++;
+        return i;
+    }
+
+    // Length of the operator at i, 0 if there is none
+    size_t operator_length(size_t i, std::string& op) const {
+        if (at_keyword(i, "AND")) {
+            size_t next = skip_spaces_from(i + 3);
+            if (next > i + 3 && at_keyword(next, "NOT")) {
+                op = "AND NOT";
+                return next + 3 - i;
             }
+            op = "AND";
+            return 3;
         }
+        if (at_keyword(i, "OR")) {
+            op = "OR";
+            return 2;
+        }
+        return 0;
     }
 
-public:
-    QueryTree(const std::string& query, bool ignore_case = true) {
-        root = parse_query(query, ignore_case);
+    // Unquoted words with '*' or '?' are patterns
+    uint32_t make_word(std::string word, bool quoted) {
+        if (ignore_case) {
+            std::transform(word.begin(), word.end(), word.begin(),
+                           [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+        }
+        QueryOp op = !quoted && WordPattern::isPattern(word) ? QueryOp::Pattern : QueryOp::Word;
+        auto it = term_ids.find(word);
+        uint32_t term = it != term_ids.end() ? it->second : term_ids[word] = tree.addTerm(word);
+        return tree.addNode(op, term, 0);
     }
 
-    // Copy constructor
-    QueryTree(const QueryTree& other) : root(cloneNode(other.root.get())) {}
+    uint32_t parse_expression() {
+        skip_spaces();
+        if ((at_keyword(pos, "NOT") || at_keyword(pos, "not")) && pos + 3 < query.size()) {
+            pos += 3;
+            return tree.addNode(QueryOp::Not, parse_expression(), 0);
+        }
 
-    std::string toString(bool flattened = true) const {
-        if (flattened) {
-            return toStringFlattenedORs();
+        uint32_t left = parse_operand();
+        skip_spaces();
+        std::string op;
+        size_t length = pos < query.size() ? operator_length(pos, op) : 0;
+        if (length == 0) {
+            return left;
         }
-        return root ? root->toString() : "";
+        pos += length;
+        uint32_t right = parse_expression();
+        return tree.addNode(QueryTree::parseOp(op), left, right);
     }
 
-    std::string toStringFlattenedORs() const {
-        return root ? root->toStringFlattenedORs() : "";
-    }
+    uint32_t parse_operand() {
+        skip_spaces();
+        if (pos >= query.size()) {
+            throw QueryParseError(query.empty() ? "Empty query" : "Expected a word", pos);
+        }
 
-    void expand(const std::vector<int>& path, const std::string& newWord, const std::string& op = "AND") {
-        root = expandNodeAt(root.get(), path, 0, newWord, op);
-    }
+        if (query[pos] == '(') {
+            size_t open = pos++;
+            uint32_t node = parse_expression();
+            skip_spaces();
+            if (pos >= query.size() || query[pos] != ')') {
+                throw QueryParseError("Unclosed parenthesis", open);
+            }
+            pos++;
+            return node;
+        }
 
-    std::vector<QueryTree> generateAllExpansions(const std::string& newWord) const {
-        // Collect paths to all WordNodes
-        std::vector<std::vector<int>> wordNodePaths;
-        std::vector<int> currentPath;
-        collectWordNodePaths(root.get(), currentPath, wordNodePaths);
+        if (query[pos] == '"') {
+            size_t close = query.find('"', pos + 1);
+            if (close == std::string::npos) {
+                throw QueryParseError("Unclosed quote", pos);
+            }
+            std::string word = query.substr(pos + 1, close - pos - 1);
+            pos = close + 1;
+            return make_word(word, true);
+        }
 
-        std::vector<QueryTree> expansions;
-        for (const auto& path : wordNodePaths) {
-            for (const auto& op : {"AND", "OR", "AND NOT"}) {
-                // Clone the tree and replace the WordNode at path
-                auto newRoot = cloneAndReplaceAtPath(root.get(), path, 0, newWord, op);
-                QueryTree newTree(*this);
-                newTree.root = std::move(newRoot);
-                expansions.push_back(std::move(newTree));
+        if (query[pos] == ')') {
+            throw QueryParseError("Expected a word", pos);
+        }
+
+        // Words run until a parenthesis, a quote or an operator
+        size_t start = pos;
+        size_t end = pos;
+        std::string op;
+        while (pos < query.size() && query[pos] != '(' && query[pos] != ')' && query[pos] != '"') {
+            if (is_space(query[pos])) {
+                pos++;
+                continue;
+            }
+            if (pos > start && operator_length(pos, op) > 0) {
+                break;
             }
+            while (!at_boundary(pos)) pos++;
+            end = pos;
         }
-        return expansions;
+        if (end == start) {
+            throw QueryParseError("Expected a word", start);
+        }
+        pos = end;
+        return make_word(query.substr(start, end - start), false);
     }
 
-    const QueryNode* getRoot() const { return root.get(); }
-
-    std::string repr() const {
-        return "QueryTree(\"" + toString() + "\")";
+public:
+    QueryParser(const std::string& q, bool ignore_case, QueryTree& tree)
+        : query(q), pos(0), ignore_case(ignore_case), tree(tree) {}
+
+    // Index of the root node
+    uint32_t parse() {
+        skip_spaces();
+        if (pos >= query.size()) {
+            throw QueryParseError("Empty query", pos);
+        }
+        uint32_t root = parse_expression();
+        skip_spaces();
+        if (pos < query.size()) {
+            throw QueryParseError(query[pos] == ')' ? "Unmatched parenthesis" : "Expected an operator", pos);
+        }
+        return root;
     }
 };
+
+inline QueryTree::QueryTree(const std::string& query, bool ignore_case) {
+    root = QueryParser(query, ignore_case, *this).parse();
+}
+
+inline std::string QueryNode::toString() const { return tree->toString(index, false); }
+inline std::string QueryNode::toStringFlattenedORs() const { return tree->toString(index, true); }
+inline std::string WordNode::getWord() const { return std::string(tree->getWord(index)); }
+inline std::string_view PatternNode::prefix() const { return WordPattern::prefix(tree->getWord(index)); }
+inline bool PatternNode::matches(std::string_view term) const {
+    return WordPattern::matches(tree->getWord(index), term);
+}
+inline const QueryNode* NotNode::getChild() const { return tree->view(tree->getNode(index).left); }
+inline const QueryNode* BinaryOpNode::getLeft() const { return tree->view(tree->getNode(index).left); }
+inline const QueryNode* BinaryOpNode::getRight() const { return tree->view(tree->getNode(index).right); }
@@ -0,0 +1,217 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <cmath>
+#include <queue>
+#include <utility>
+#include <algorithm>
+#include "postings.h"
+#include "doc_cursor.h"
+
+// Okapi BM25 with the usual k1 and b, over the statistics of a collection
+struct BM25 {
+    static constexpr double K1 = 1.2;
+    static constexpr double B = 0.75;
+
+    double document_count;
+    double average_length;
+
+    BM25(size_t document_count, uint64_t total_length)
+        : document_count(static_cast<double>(document_count)),
+          average_length(document_count && total_length ? double(total_length) / document_count : 1.0) {}
+
+    double idf(size_t document_frequency) const {
+        return std::log(1.0 + (document_count - document_frequency + 0.5) / (document_frequency + 0.5));
+    }
+
+    // Increases with the frequency and decreases with the length, so that
+    // the impact of a block bounds the score of each of its docs
+    double score(double idf, uint32_t frequency, uint32_t length) const {
+        double norm = K1 * (1.0 - B + B * length / average_length);
+        return idf * frequency * (K1 + 1.0) / (frequency + norm);
+    }
+};
+
+// BM25 scores of the docs of one term. Besides iterating the postings, it
+// bounds the scores of the docs ahead from block impacts alone, so that
+// blocks that cannot matter are skipped without being decoded.
+class TermScorer {
+private:
+    PostingsView postings;
+    PostingsCursor cursor;
+    const BM25& bm25;
+    const uint32_t* document_lengths;
+    double idf;
+    double tail_upper_bound;
+    double upper_bound;
+    uint32_t frequencies[BlockCodec::BLOCK_SIZE];
+    size_t decoded_block;  // Block whose frequencies are in `frequencies`
+    size_t shallow_block;  // Block holding the last target of block_max_score
+
+public:
+    TermScorer(const PostingsView& postings, const BM25& bm25, const uint32_t* document_lengths)
+        : postings(postings), cursor(postings), bm25(bm25), document_lengths(document_lengths),
+          idf(bm25.idf(postings.size())), tail_upper_bound(0), upper_bound(0),
+          decoded_block(SIZE_MAX), shallow_block(0) {
+        for (size_t i = 0; i < postings.tail_size; ++i) {
+            double score = bm25.score(idf, postings.tail_frequencies[i], document_lengths[postings.tail[i]]);
+            tail_upper_bound = std::max(tail_upper_bound, score);
+        }
+        upper_bound = tail_upper_bound;
+        for (size_t b = 0; b < postings.num_blocks; ++b) {
+            const BlockImpact& impact = postings.impacts[b];
+            upper_bound = std::max(upper_bound, bm25.score(idf, impact.max_frequency, impact.min_length));
+        }
+    }
+
+    int doc() const { return cursor.doc(); }
+    int next() { return cursor.next(); }
+    int advance(int target) { return cursor.advance(target); }
+
+    // Upper bound on the score of any doc of the term
+    double max_score() const { return upper_bound; }
+
+    // Score of the current doc
+    double score() {
+        size_t block = cursor.current_block();
+        uint32_t frequency;
+        if (block < postings.num_blocks) {
+            if (decoded_block != block) {
+                postings.decode_frequencies(block, frequencies);
+                decoded_block = block;
+            }
+            frequency = frequencies[cursor.current_position()];
+        } else {
+            frequency = postings.tail_frequencies[cursor.current_position()];
+        }
+        return bm25.score(idf, frequency, document_lengths[cursor.doc()]);
+    }
+
+    // Upper bound on the score of the docs from target up to `block_end`, the
+    // last doc of the block that can hold target (END for the tail). Targets
+    // must not decrease between calls.
+    double block_max_score(int target, int& block_end) {
+        shallow_block = std::max(shallow_block, cursor.current_block());
+        while (shallow_block < postings.num_blocks && postings.block_last_doc(shallow_block) < target) {
+            shallow_block++;
+        }
+        if (shallow_block < postings.num_blocks) {
+            block_end = postings.block_last_doc(shallow_block);
+            const BlockImpact& impact = postings.impacts[shallow_block];
+            return bm25.score(idf, impact.max_frequency, impact.min_length);
+        }
+        block_end = DocCursor::END;
+        return tail_upper_bound;
+    }
+};
+
+// Best k docs matching `filter` by the sum of their term scores, best first
+// and by doc id among equal scores. Docs matching none of the terms are not
+// considered.
+//
+// Block-max WAND: the terms are kept ordered by their current doc, and the
+// pivot is the first doc whose terms could together beat the k-th best score
+// so far. Docs before the pivot are skipped, and so is the pivot itself when
+// the block impacts of its terms rule it out, up to the end of the first of
+// their blocks. Candidates are then checked against the filter, whose next
+// match lets every term jump ahead as well.
+inline std::vector<std::pair<int, double>> top_k(DocCursor& filter, std::vector<std::unique_ptr<TermScorer>>& terms,
+                                                 size_t k) {
+    using Result = std::pair<int, double>;
+    auto better = [](const Result& a, const Result& b) {
+        return a.second > b.second || (a.second == b.second && a.first < b.first);
+    };
+    // Worst result on top
+    std::priority_queue<Result, std::vector<Result>, decltype(better)> heap(better);
+    if (k == 0) {
+        return {};
+    }
+
+    std::vector<TermScorer*> order;
+    for (auto& term : terms) {
+        term->next();
+        order.push_back(term.get());
+    }
+    auto advance_below = [&](size_t count, int target) {
+        for (size_t i = 0; i < count; ++i) {
+            if (order[i]->doc() < target) order[i]->advance(target);
+        }
+    };
+
+    while (true) {
+        // Insertion sort, as the order barely changes between iterations
+        for (size_t i = 1; i < order.size(); ++i) {
+            for (size_t j = i; j > 0 && order[j]->doc() < order[j - 1]->doc(); --j) {
+                std::swap(order[j], order[j - 1]);
+            }
+        }
+
+        double threshold = heap.size() < k ? 0.0 : heap.top().second;
+        double bound = 0;
+        size_t pivot = order.size();
+        for (size_t i = 0; i < order.size() && order[i]->doc() != DocCursor::END; ++i) {
+            bound += order[i]->max_score();
+            if (bound > threshold) {
+                pivot = i;
+                break;
+            }
+        }
+        if (pivot == order.size()) {
+            break;
+        }
+        int pivot_doc = order[pivot]->doc();
+        while (pivot + 1 < order.size() && order[pivot + 1]->doc() == pivot_doc) {
+            pivot++;
+        }
+
+        double block_bound = 0;
+        int boundary = DocCursor::END;
+        for (size_t i = 0; i <= pivot; ++i) {
+            int block_end;
+            block_bound += order[i]->block_max_score(pivot_doc, block_end);
+            boundary = std::min(boundary, block_end);
+        }
+        if (block_bound <= threshold) {
+            int target = boundary == DocCursor::END ? DocCursor::END : boundary + 1;
+            if (pivot + 1 < order.size()) {
+                target = std::min(target, order[pivot + 1]->doc());
+            }
+            advance_below(pivot + 1, target);
+            continue;
+        }
+
+        if (order[0]->doc() != pivot_doc) {
+            advance_below(pivot, pivot_doc);
+            continue;
+        }
+
+        int match = filter.advance(pivot_doc);
+        if (match == pivot_doc) {
+            // Sum in term order, so that a doc always gets the same score
+            double score = 0;
+            for (auto& term : terms) {
+                if (term->doc() == pivot_doc) score += term->score();
+            }
+            Result result(pivot_doc, score);
+            if (heap.size() < k) {
+                heap.push(result);
+            } else if (better(result, heap.top())) {
+                heap.pop();
+                heap.push(result);
+            }
+        } else if (match == DocCursor::END) {
+            break;
+        }
+        advance_below(pivot + 1, match == pivot_doc ? pivot_doc + 1 : match);
+    }
+
+    std::vector<Result> results;
+    results.reserve(heap.size());
+    while (!heap.empty()) {
+        results.push_back(heap.top());
+        heap.pop();
+    }
+    std::reverse(results.begin(), results.end());
+    return results;
+}
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <initializer_list>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+// Thread-safe LRU cache of the doc ids matching query subtrees, bounded by
+// the bytes its entries hold. Keys are canonical forms of plan nodes (see
+// PlanNode::assignKeys), so a subtree shared by different queries, with its
+// operands in any order, is evaluated once. Each entry records the number of
+// documents of the index it was computed over, so that the index can extend
+// it with the documents added since. Entries are immutable and shared with
+// the cursors reading them, which keeps them valid after eviction.
+//
+// Keys are admitted on their second miss (see admit()): most subtrees are
+// never seen again, and are not worth materializing or their memory.
+class ResultCache {
+public:
+    struct Entry {
+        std::shared_ptr<const std::vector<int>> docs;
+        int document_count = 0;  // Documents of the index when the entry was computed
+    };
+
+    struct Counters {
+        uint64_t hits = 0;        // Lookups finding an entry, up to date or not
+        uint64_t misses = 0;      // Lookups of keys that could have been stored
+        uint64_t extensions = 0;  // Entries extended to documents added after them
+        uint64_t evictions = 0;
+        size_t entries = 0;
+        size_t bytes = 0;
+        size_t capacity = 0;
+    };
+
+private:
+    using Item = std::pair<std::string, Entry>;
+
+    // Bookkeeping of an entry besides its key and docs: list and hash nodes
+    static constexpr size_t ENTRY_OVERHEAD = sizeof(Item) + 8 * sizeof(void*);
+    // Hashes of missed keys admit() remembers, forgotten all at once beyond
+    static constexpr size_t MAX_CANDIDATES = 1 << 16;
+
+    std::atomic<size_t> capacity;
+    size_t bytes;
+    std::list<Item> items;  // Most recently used first
+    std::unordered_map<std::string, std::list<Item>::iterator> positions;
+    std::unordered_set<size_t> candidates;  // Hashes of keys that missed once
+    mutable std::mutex mutex;
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> misses{0};
+    std::atomic<uint64_t> extensions{0};
+    std::atomic<uint64_t> evictions{0};
+
+    static size_t size_of(const std::string& key, const Entry& entry) {
+        return ENTRY_OVERHEAD + 2 * key.size() + entry.docs->capacity() * sizeof(int);
+    }
+
+    void erase(std::list<Item>::iterator it) {
+        bytes -= size_of(it->first, it->second);
+        positions.erase(it->first);
+        items.erase(it);
+    }
+
+    void evict() {
+        while (bytes > capacity && !items.empty()) {
+            erase(std::prev(items.end()));
+            evictions.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+public:
+    // Capacity in bytes, 0 to disable the cache
+    explicit ResultCache(size_t capacity = 0) : capacity(capacity), bytes(0) {}
+
+    bool enabled() const {
+        return capacity.load(std::memory_order_relaxed) > 0;
+    }
+
+    // Finds the entry of the key, counting a hit, or a miss when the caller
+    // could store the key, so that the counters tell what a larger cache gains
+    bool find(const std::string& key, Entry& entry, bool storable = true) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = positions.find(key);
+        if (it == positions.end()) {
+            if (storable) {
+                misses.fetch_add(1, std::memory_order_relaxed);
+            }
+            return false;
+        }
+        items.splice(items.begin(), items, it->second);
+        entry = it->second->second;
+        hits.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Whether a key that missed is worth storing: true when it already missed
+    // before, false the first time, which is remembered
+    bool admit(const std::string& key) {
+        size_t hash = std::hash<std::string>()(key);
+        std::lock_guard<std::mutex> lock(mutex);
+        if (candidates.erase(hash)) {
+            return true;
+        }
+        if (candidates.size() >= MAX_CANDIDATES) {
+            candidates.clear();
+        }
+        candidates.insert(hash);
+        return false;
+    }
+
+    // Stores an entry, unless it alone exceeds the capacity or a concurrent
+    // query already stored one covering more documents. `extended` counts
+    // the entry as an extension of an older one.
+    void put(const std::string& key, Entry entry, bool extended = false) {
+        if (extended) {
+            extensions.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (size_of(key, entry) > capacity.load(std::memory_order_relaxed)) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = positions.find(key);
+        if (it != positions.end()) {
+            if (it->second->second.document_count > entry.document_count) {
+                return;
+            }
+            erase(it->second);
+        }
+        items.emplace_front(key, std::move(entry));
+        positions.emplace(key, items.begin());
+        bytes += size_of(items.front().first, items.front().second);
+        evict();
+    }
+
+    void set_capacity(size_t new_capacity) {
+        std::lock_guard<std::mutex> lock(mutex);
+        capacity = new_capacity;
+        evict();
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lock(mutex);
+        items.clear();
+        positions.clear();
+        candidates.clear();
+        bytes = 0;
+    }
+
+    Counters get() const {
+        Counters counters;
+        counters.hits = hits.load(std::memory_order_relaxed);
+        counters.misses = misses.load(std::memory_order_relaxed);
+        counters.extensions = extensions.load(std::memory_order_relaxed);
+        counters.evictions = evictions.load(std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lock(mutex);
+        counters.entries = items.size();
+        counters.bytes = bytes;
+        counters.capacity = capacity.load(std::memory_order_relaxed);
+        return counters;
+    }
+
+    void reset_counters() {
+        for (auto* counter : {&hits, &misses, &extensions, &evictions}) {
+            counter->store(0, std::memory_order_relaxed);
+        }
+    }
+};
@@ -0,0 +1,448 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <exception>
+#include <algorithm>
+#include <utility>
+#include "index.h"
+#include "query_cache.h"
+
+// Immutable part of a segmented index: a sealed Index covering a range of doc
+// ids, and the documents deleted from it
+struct IndexSegment {
+    int base;  // Global id of the first document
+    std::shared_ptr<const Index> index;
+    // Local ids of deleted documents, replaced rather than modified so that
+    // snapshots keep the set they were taken with
+    std::shared_ptr<const DocSet> deleted;
+    // Deleted documents already left out of the postings by a merge
+    size_t purged;
+
+    int end() const { return base + index->get_document_count(); }
+
+    size_t live_count() const {
+        return index->get_document_count() - deleted->cardinality();
+    }
+};
+
+// Consistent read-only view of a segmented index, pinned to the documents
+// below its watermark. Nothing it refers to is ever modified, so any number
+// of threads can search it without locking while the index keeps changing.
+// Query strings are parsed through the cache of the index it was taken from.
+class IndexSnapshot {
+private:
+    std::shared_ptr<const std::vector<IndexSegment>> segments;
+    int watermark;
+    std::shared_ptr<QueryCache> query_cache;
+
+    static std::vector<int> live_matches(const IndexSegment& segment, const QueryTree& query_tree) {
+        std::vector<int> docs = segment.index->search(query_tree);
+        const DocSet& deleted = *segment.deleted;
+        if (!deleted.empty()) {
+            docs.erase(std::remove_if(docs.begin(), docs.end(), [&](int doc) { return deleted.contains(doc); }),
+                       docs.end());
+        }
+        return docs;
+    }
+
+public:
+    explicit IndexSnapshot(std::shared_ptr<QueryCache> query_cache = std::make_shared<QueryCache>())
+        : segments(std::make_shared<const std::vector<IndexSegment>>()), watermark(0),
+          query_cache(std::move(query_cache)) {}
+
+    IndexSnapshot(std::vector<IndexSegment> sealed, std::shared_ptr<QueryCache> query_cache)
+        : segments(std::make_shared<const std::vector<IndexSegment>>(std::move(sealed))),
+          watermark(segments->empty() ? 0 : segments->back().end()), query_cache(std::move(query_cache)) {}
+
+    std::vector<int> search(const QueryTree& query_tree) const {
+        std::vector<int> result;
+        for (const auto& segment : *segments) {
+            for (int doc : live_matches(segment, query_tree)) {
+                result.push_back(segment.base + doc);
+            }
+        }
+        return result;
+    }
+
+    std::vector<int> search(const std::string& query_string, bool ignore_case = true) const {
+        return search(*query_cache->get(query_string, ignore_case));
+    }
+
+    int count(const QueryTree& query_tree) const {
+        size_t total = 0;
+        for (const auto& segment : *segments) {
+            total += segment.deleted->empty() ? segment.index->count(query_tree)
+                                              : live_matches(segment, query_tree).size();
+        }
+        return static_cast<int>(total);
+    }
+
+    int count(const std::string& query_string, bool ignore_case = true) const {
+        return count(*query_cache->get(query_string, ignore_case));
+    }
+
+    // Number of doc ids visible in the snapshot, deleted documents included
+    int get_document_count() const {
+        return watermark;
+    }
+
+    int get_deleted_count() const {
+        size_t total = 0;
+        for (const auto& segment : *segments) {
+            total += segment.deleted->cardinality();
+        }
+        return static_cast<int>(total);
+    }
+
+    size_t get_segment_count() const {
+        return segments->size();
+    }
+
+    const std::vector<IndexSegment>& get_segments() const {
+        return *segments;
+    }
+};
+
+// Log-structured index: documents go to a small in-memory write buffer, which
+// is sealed into an immutable segment once full or flushed. Deleting a
+// document only marks it in its segment, and queries fan out over the
+// segments and skip marked documents. A background thread merges runs of
+// similarly sized segments, which also drops deleted documents from the
+// postings, so that the number of segments stays logarithmic in the number
+// of documents.
+//
+// Doc ids are assigned in insertion order and never change: segments cover
+// consecutive ranges of ids and merged segments keep the ids of deleted
+// documents as holes.
+//
+// Writers serialize on a mutex and publish a new IndexSnapshot after every
+// change to the sealed segments; readers only load the latest snapshot, so
+// searches never wait for writers or merges. Buffered documents become
+// visible once the buffer is sealed.
+class SegmentedIndex {
+private:
+    using Segment = IndexSegment;
+
+    size_t buffer_size;
+    size_t merge_factor;
+    bool compress_postings;
+
+    // Guards everything below but the published snapshot
+    mutable std::mutex mutex;
+    std::vector<Segment> segments;  // Ordered by base, as of the latest change
+    std::unique_ptr<Index> buffer;
+    DocSet buffer_deleted;
+    int buffer_base;
+    // Shared with the snapshots, which may outlive the index
+    std::shared_ptr<QueryCache> query_cache;
+
+    // Held for the whole duration of a merge, so that merges do not overlap
+    std::mutex merge_mutex;
+    std::condition_variable merge_wanted;
+    std::condition_variable merges_done;
+    bool merge_pending;
+    bool stopping;
+    std::exception_ptr merge_error;
+    std::thread merger;
+
+    // Latest state of the sealed segments, only accessed atomically
+    std::shared_ptr<const IndexSnapshot> published;
+
+    static std::shared_ptr<const DocSet> with_doc(const DocSet& set, int doc_id) {
+        return std::make_shared<const DocSet>(set.unite(DocSet::from_sorted({doc_id})));
+    }
+
+    // Must be called with mutex held after every change to the segments
+    void publish() {
+        std::atomic_store(&published, std::make_shared<const IndexSnapshot>(segments, query_cache));
+    }
+
+    // Smallest k such that a segment of `live` documents fits in
+    // buffer_size * merge_factor^k
+    size_t tier(size_t live) const {
+        size_t tier = 0;
+        for (size_t limit = buffer_size; live > limit; limit *= merge_factor) {
+            tier++;
+        }
+        return tier;
+    }
+
+    // Range of segments to merge next, empty when there is none: the oldest
+    // run of merge_factor adjacent segments of the same tier, or else a single
+    // segment with more deleted documents in its postings than live ones
+    std::pair<size_t, size_t> pick_merge() const {
+        size_t run = 0;
+        for (size_t i = 0; i < segments.size(); ++i) {
+            bool same_tier = i > 0 && tier(segments[i].live_count()) == tier(segments[i - 1].live_count());
+            run = same_tier ? run + 1 : 1;
+            if (run == merge_factor) {
+                return {i + 1 - run, i + 1};
+            }
+        }
+        for (size_t i = 0; i < segments.size(); ++i) {
+            const Segment& segment = segments[i];
+            if ((segment.deleted->cardinality() - segment.purged) * 2 > size_t(segment.index->get_document_count())) {
+                return {i, i + 1};
+            }
+        }
+        return {0, 0};
+    }
+
+    // Must be called with mutex held
+    void seal_buffer() {
+        if (buffer->get_document_count() == 0) {
+            return;
+        }
+        Segment segment;
+        segment.base = buffer_base;
+        segment.index = std::shared_ptr<const Index>(std::move(buffer));
+        segment.deleted = std::make_shared<const DocSet>(std::move(buffer_deleted));
+        segment.purged = 0;
+        buffer_base = segment.end();
+        segments.push_back(std::move(segment));
+        buffer = std::make_unique<Index>(compress_postings);
+        buffer_deleted = DocSet();
+        publish();
+        merge_pending = true;
+        merge_wanted.notify_one();
+    }
+
+    // Merges segments [first, last) into one. Must be called with merge_mutex
+    // held, which guarantees that the range is not replaced meanwhile.
+    void merge_segments(size_t first, size_t last) {
+        std::vector<Segment> sources;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            sources.assign(segments.begin() + first, segments.begin() + last);
+        }
+
+        auto merged = std::make_unique<Index>(compress_postings);
+        size_t purged = 0;
+        for (const auto& source : sources) {
+            merged->append(*source.index, source.deleted.get());
+            purged += source.deleted->cardinality();
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        // Documents may have been deleted while merging: carry over the
+        // current deletions of every source
+        DocSet deleted;
+        for (const auto& source : sources) {
+            const Segment& current = segments[first + (&source - sources.data())];
+            int offset = current.base - sources.front().base;
+            for (int doc : current.deleted->to_vector()) {
+                deleted.push_back(doc + offset);
+            }
+        }
+        Segment segment;
+        segment.base = sources.front().base;
+        segment.index = std::shared_ptr<const Index>(std::move(merged));
+        segment.deleted = std::make_shared<const DocSet>(std::move(deleted));
+        segment.purged = purged;
+        segments.erase(segments.begin() + first + 1, segments.begin() + last);
+        segments[first] = std::move(segment);
+        publish();
+    }
+
+    void merge_loop() {
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                merge_wanted.wait(lock, [this] { return stopping || merge_pending; });
+                if (stopping) return;
+            }
+            std::lock_guard<std::mutex> merge_lock(merge_mutex);
+            std::pair<size_t, size_t> range;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                range = pick_merge();
+                if (range.first == range.second) {
+                    merge_pending = false;
+                    merges_done.notify_all();
+                    continue;
+                }
+            }
+            try {
+                merge_segments(range.first, range.second);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(mutex);
+                merge_error = std::current_exception();
+                merge_pending = false;
+                merges_done.notify_all();
+            }
+        }
+    }
+
+public:
+    explicit SegmentedIndex(size_t buffer_size = 10000, size_t merge_factor = 4, bool compress_postings = true)
+        : buffer_size(std::max<size_t>(buffer_size, 1)), merge_factor(std::max<size_t>(merge_factor, 2)),
+          compress_postings(compress_postings), buffer(std::make_unique<Index>(compress_postings)),
+          buffer_base(0), query_cache(std::make_shared<QueryCache>()), merge_pending(false), stopping(false),
+          published(std::make_shared<const IndexSnapshot>(query_cache)) {
+        merger = std::thread([this] { merge_loop(); });
+    }
+
+    ~SegmentedIndex() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        merge_wanted.notify_one();
+        merges_done.notify_all();
+        merger.join();
+    }
+
+    SegmentedIndex(const SegmentedIndex&) = delete;
+    SegmentedIndex& operator=(const SegmentedIndex&) = delete;
+
+    // Returns the id of the new document
+    int add_document(const std::vector<std::string>& words) {
+        std::lock_guard<std::mutex> lock(mutex);
+        int doc_id = buffer_base + buffer->get_document_count();
+        buffer->add_document(words);
+        if (size_t(buffer->get_document_count()) >= buffer_size) {
+            seal_buffer();
+        }
+        return doc_id;
+    }
+
+    void add_documents(const std::vector<std::vector<std::string>>& documents, size_t num_threads = 0) {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t i = 0;
+        while (i < documents.size()) {
+            size_t room = buffer_size - buffer->get_document_count();
+            size_t end = std::min(documents.size(), i + room);
+            buffer->add_documents(std::vector<std::vector<std::string>>(documents.begin() + i, documents.begin() + end),
+                                  num_threads);
+            i = end;
+            if (size_t(buffer->get_document_count()) >= buffer_size) {
+                seal_buffer();
+            }
+        }
+    }
+
+    // Returns false when the document does not exist or was already deleted
+    bool remove_document(int doc_id) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (doc_id < 0 || doc_id >= buffer_base + buffer->get_document_count()) {
+            return false;
+        }
+        if (doc_id >= buffer_base) {
+            int local = doc_id - buffer_base;
+            if (buffer_deleted.contains(local)) return false;
+            buffer_deleted = buffer_deleted.unite(DocSet::from_sorted({local}));
+            return true;
+        }
+        auto it = std::upper_bound(segments.begin(), segments.end(), doc_id,
+                                   [](int id, const Segment& s) { return id < s.base; });
+        Segment& segment = *(it - 1);
+        int local = doc_id - segment.base;
+        if (segment.deleted->contains(local)) {
+            return false;
+        }
+        segment.deleted = with_doc(*segment.deleted, local);
+        publish();
+        if ((segment.deleted->cardinality() - segment.purged) * 2 > size_t(segment.index->get_document_count())) {
+            merge_pending = true;
+            merge_wanted.notify_one();
+        }
+        return true;
+    }
+
+    // Current state of the sealed segments, which later changes do not affect
+    IndexSnapshot snapshot() const {
+        return *std::atomic_load(&published);
+    }
+
+    std::vector<int> search(const QueryTree& query_tree) const {
+        return snapshot().search(query_tree);
+    }
+
+    std::vector<int> search(const std::string& query_string, bool ignore_case = true) const {
+        return search(*query_cache->get(query_string, ignore_case));
+    }
+
+    int count(const QueryTree& query_tree) const {
+        return snapshot().count(query_tree);
+    }
+
+    int count(const std::string& query_string, bool ignore_case = true) const {
+        return count(*query_cache->get(query_string, ignore_case));
+    }
+
+    // Seals the write buffer into a segment, even if it is not full, which
+    // makes its documents visible to searches
+    void flush() {
+        std::lock_guard<std::mutex> lock(mutex);
+        seal_buffer();
+    }
+
+    // Blocks until the background merges have caught up, rethrowing the error
+    // of a failed merge
+    void wait_for_merges() {
+        std::unique_lock<std::mutex> lock(mutex);
+        merges_done.wait(lock, [this] { return !merge_pending || stopping; });
+        if (merge_error) {
+            std::exception_ptr error = merge_error;
+            merge_error = nullptr;
+            std::rethrow_exception(error);
+        }
+    }
+
+    // Flushes the buffer and merges every segment into one, dropping all the
+    // deleted documents from the postings
+    void compact() {
+        std::lock_guard<std::mutex> merge_lock(merge_mutex);
+        size_t num_segments;
+        bool has_deleted;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            seal_buffer();
+            num_segments = segments.size();
+            has_deleted = num_segments == 1 && segments[0].deleted->cardinality() > segments[0].purged;
+        }
+        if (num_segments > 1 || has_deleted) {
+            merge_segments(0, num_segments);
+        }
+    }
+
+    // Number of doc ids assigned so far, deleted documents included. Documents
+    // still in the write buffer are counted but not searchable until flush().
+    int get_document_count() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return buffer_base + buffer->get_document_count();
+    }
+
+    // Number of doc ids visible to searches, i.e. those of the sealed segments
+    int get_visible_document_count() const {
+        return snapshot().get_document_count();
+    }
+
+    int get_deleted_count() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t total = buffer_deleted.cardinality();
+        for (const auto& segment : segments) {
+            total += segment.deleted->cardinality();
+        }
+        return static_cast<int>(total);
+    }
+
+    size_t get_segment_count() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return segments.size();
+    }
+
+    size_t memory_usage() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t total = buffer->memory_usage() + buffer_deleted.memory_usage();
+        for (const auto& segment : segments) {
+            total += segment.index->memory_usage() + segment.deleted->memory_usage();
+        }
+        return total;
+    }
+};
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <utility>
+
+// Mutable term -> id dictionary. Term bytes are packed back to back in a
+// single arena and ids are assigned in insertion order, so a term costs its
+// bytes plus an 8-byte arena offset and a few bytes of hash slot, with no
+// per-term allocation.
+class TermDictionary {
+public:
+    static constexpr uint32_t NOT_FOUND = UINT32_MAX;
+
+private:
+    std::vector<char> arena;
+    std::vector<uint64_t> offsets;  // Term i spans [offsets[i], offsets[i + 1])
+    std::vector<uint32_t> slots;    // Open addressing table of id + 1, 0 when empty
+
+    static uint64_t hash(std::string_view term) {
+        // FNV-1a
+        uint64_t h = 1469598103934665603ull;
+        for (char c : term) {
+            h ^= static_cast<unsigned char>(c);
+            h *= 1099511628211ull;
+        }
+        return h;
+    }
+
+    // Slot holding the term, or the empty slot where it would be inserted
+    size_t find_slot(std::string_view term) const {
+        size_t mask = slots.size() - 1;
+        size_t slot = hash(term) & mask;
+        while (slots[slot] != 0 && this->term(slots[slot] - 1) != term) {
+            slot = (slot + 1) & mask;
+        }
+        return slot;
+    }
+
+    void rehash(size_t capacity) {
+        std::vector<uint32_t>(capacity, 0).swap(slots);
+        size_t mask = capacity - 1;
+        for (uint32_t id = 0; id < size(); ++id) {
+            size_t slot = hash(term(id)) & mask;
+            while (slots[slot] != 0) {
+                slot = (slot + 1) & mask;
+            }
+            slots[slot] = id + 1;
+        }
+    }
+
+public:
+    TermDictionary() : offsets(1, 0), slots(16, 0) {}
+
+    size_t size() const { return offsets.size() - 1; }
+
+    std::string_view term(uint32_t id) const {
+        return std::string_view(arena.data() + offsets[id], offsets[id + 1] - offsets[id]);
+    }
+
+    uint32_t find(std::string_view term) const {
+        uint32_t value = slots[find_slot(term)];
+        return value == 0 ? NOT_FOUND : value - 1;
+    }
+
+    // Returns the id of the term and whether it was just added
+    std::pair<uint32_t, bool> insert(std::string_view term) {
+        size_t slot = find_slot(term);
+        if (slots[slot] != 0) {
+            return {slots[slot] - 1, false};
+        }
+        uint32_t id = static_cast<uint32_t>(size());
+        arena.insert(arena.end(), term.begin(), term.end());
+        offsets.push_back(arena.size());
+        slots[slot] = id + 1;
+        // Keep the load factor under 3/4
+        if (size() * 4 >= slots.size() * 3) {
+            rehash(slots.size() * 2);
+        }
+        return {id, true};
+    }
+
+    void reserve(size_t terms) {
+        offsets.reserve(terms + 1);
+        size_t capacity = slots.size();
+        while (terms * 4 >= capacity * 3) {
+            capacity *= 2;
+        }
+        if (capacity != slots.size()) {
+            rehash(capacity);
+        }
+    }
+
+    // Term ids in lexicographic order of their terms
+    std::vector<uint32_t> sorted_ids() const {
+        std::vector<uint32_t> ids(size());
+        for (uint32_t id = 0; id < ids.size(); ++id) {
+            ids[id] = id;
+        }
+        std::sort(ids.begin(), ids.end(), [this](uint32_t a, uint32_t b) { return term(a) < term(b); });
+        return ids;
+    }
+
+    void clear() {
+        arena.clear();
+        offsets.assign(1, 0);
+        slots.assign(16, 0);
+    }
+
+    size_t memory_usage() const {
+        return arena.capacity() + offsets.capacity() * sizeof(uint64_t) + slots.capacity() * sizeof(uint32_t);
+    }
+};
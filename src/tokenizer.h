@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cctype>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "term_dictionary.h"
+
+// Splits UTF-8 text into words: maximal runs of ASCII letters and digits,
+// bytes of multi-byte UTF-8 sequences and extra_chars. With ignore_case,
+// words are lowercased the way QueryTree lowercases query words, so that
+// queries parsed with the same setting find them. Words shorter than
+// min_length or longer than max_length characters (0 for no limit), and
+// stopwords, are dropped.
+class Tokenizer {
+private:
+    bool ignore_case;
+    size_t min_length;
+    size_t max_length;
+    bool word_chars[256];
+    TermDictionary stopwords;
+
+    static char lower(char c) {
+        return static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    }
+
+public:
+    explicit Tokenizer(bool ignore_case = true, size_t min_length = 1, size_t max_length = 0,
+                       const std::vector<std::string>& stopwords = {}, const std::string& extra_chars = "")
+        : ignore_case(ignore_case), min_length(min_length), max_length(max_length) {
+        for (int c = 0; c < 256; ++c) {
+            word_chars[c] = c >= 0x80 || std::isalnum(c);
+        }
+        for (char c : extra_chars) {
+            word_chars[static_cast<unsigned char>(c)] = true;
+        }
+        for (std::string word : stopwords) {
+            if (ignore_case) {
+                for (char& c : word) c = lower(c);
+            }
+            this->stopwords.insert(word);
+        }
+    }
+
+    // Passes each word of the text to emit(std::string_view). The view is
+    // only valid during the call.
+    template <typename Emit>
+    void tokenize(std::string_view text, Emit&& emit) const {
+        std::string lowered;
+        size_t i = 0;
+        while (i < text.size()) {
+            while (i < text.size() && !word_chars[static_cast<unsigned char>(text[i])]) {
+                i++;
+            }
+            size_t start = i;
+            size_t length = 0;
+            bool has_upper = false;
+            for (; i < text.size() && word_chars[static_cast<unsigned char>(text[i])]; ++i) {
+                unsigned char c = static_cast<unsigned char>(text[i]);
+                // Count characters, not UTF-8 continuation bytes
+                length += (c & 0xC0) != 0x80;
+                has_upper |= c >= 'A' && c <= 'Z';
+            }
+            if (length == 0 || length < min_length || (max_length && length > max_length)) {
+                continue;
+            }
+            std::string_view word = text.substr(start, i - start);
+            if (ignore_case && has_upper) {
+                lowered.assign(word);
+                for (char& c : lowered) c = lower(c);
+                word = lowered;
+            }
+            if (stopwords.size() && stopwords.find(word) != TermDictionary::NOT_FOUND) {
+                continue;
+            }
+            emit(word);
+        }
+    }
+
+    std::vector<std::string> tokenize(std::string_view text) const {
+        std::vector<std::string> words;
+        tokenize(text, [&](std::string_view word) { words.emplace_back(word); });
+        return words;
+    }
+};
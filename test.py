@@ -43,7 +43,7 @@ def print_tree_structure(node, indent=""):
 query_tree = eldarcpp.QueryTree("obama OR president")
 print("Original query:", query_tree.to_string())
 
-query_tree.expand("biden")
+query_tree.expand([], "biden")
 print("Expanded query:", query_tree.to_string())
 
 # Traverse the tree structure
@@ -55,7 +55,7 @@ print_tree_structure(root)
 operators = ["AND", "OR", "AND NOT"]
 for op in operators:
     new_tree = eldarcpp.QueryTree("obama OR president")
-    new_tree.expand("biden", op)
+    new_tree.expand([], "biden", op)
     print(f"\nExpanded with {op}:", new_tree.to_string())
     print(f"Tree structure for {op} expansion:")
     print_tree_structure(new_tree.get_root())
@@ -13,3 +13,6 @@ for i, expanded_tree in enumerate(all_expansions, 1):
     print("Query:", expanded_tree.to_string())
 
 print(f"\nTotal number of expansions: {len(all_expansions)}")
+assert len(all_expansions) == 6
+assert all_expansions[0].to_string() == "((trump AND kamala) AND donald)"
+assert query_tree.to_string() == "(trump AND donald)"
@@ -0,0 +1,142 @@
+import random
+
+import eldarcpp
+
+
+def parse(query, ignore_case=True):
+    return eldarcpp.QueryTree(query, ignore_case)
+
+
+def check_parse(query, expected, flattened=True):
+    result = parse(query).to_string(flattened)
+    print(f"{query!r} -> {result}")
+    assert result == expected, (query, result)
+
+
+def check_error(query):
+    try:
+        parse(query)
+    except eldarcpp.QueryParseError as error:
+        assert isinstance(error, ValueError)
+        print(f"{query!r} -> {error}")
+        return
+    raise AssertionError(f"{query!r} parsed")
+
+
+# Quoting, multi-word terms and case
+check_parse('"new york" AND city', "(new york AND city)")
+check_parse("new york OR boston", "(new york OR boston)")
+check_parse("Obama", "obama")
+assert parse("Obama", ignore_case=False).to_string() == "Obama"
+check_parse("a ANDroid", "a android")
+
+# Operators bind to the right, whatever they are
+check_parse("a OR b AND c", "(a OR (b AND c))")
+check_parse("a OR (b OR c)", "(a OR b OR c)")
+check_parse("a OR (b OR c)", "(a OR (b OR c))", flattened=False)
+check_parse("NOT (a OR b) AND c", "NOT ((a OR b) AND c)")
+
+# AND NOT is its own operator, while a lowercase not is a negation
+root = parse("a AND NOT b").get_root()
+assert isinstance(root, eldarcpp.AndNotNode)
+assert root.to_string() == "(a AND NOT b)"
+root = parse("a AND not b").get_root()
+assert isinstance(root, eldarcpp.AndNode)
+assert isinstance(root.get_right(), eldarcpp.NotNode)
+for query in ["not a", "NOT a"]:
+    root = parse(query).get_root()
+    assert isinstance(root, eldarcpp.NotNode), query
+    assert root.get_child().get_word() == "a", query
+assert isinstance(parse("NOT (a OR b)").get_root().get_child(), eldarcpp.OrNode)
+
+# Only unquoted words with wildcards are patterns
+root = parse("c*t OR dog").get_root()
+assert isinstance(root.get_left(), eldarcpp.PatternNode)
+assert root.get_left().prefix() == "c"
+assert root.get_left().matches("cat") and not root.get_left().matches("dog")
+assert not isinstance(root.get_right(), eldarcpp.PatternNode)
+root = parse('"c*t" OR dog').get_root()
+assert isinstance(root.get_left(), eldarcpp.WordNode)
+assert not isinstance(root.get_left(), eldarcpp.PatternNode)
+assert root.get_left().get_word() == "c*t"
+
+for query in ["(a AND b", "a AND", '"unclosed', "", "a )"]:
+    check_error(query)
+
+# Expanding a node replaces it with its combination with the new word, and
+# leaves the nodes returned before untouched
+query_tree = parse("obama OR president")
+old_root = query_tree.get_root()
+query_tree.expand([], "biden")
+assert query_tree.to_string() == "((obama OR president) AND biden)"
+assert old_root.to_string() == "(obama OR president)"
+root = query_tree.get_root()
+assert isinstance(root, eldarcpp.AndNode)
+assert isinstance(root.get_left(), eldarcpp.OrNode)
+assert root.get_left().get_left().get_word() == "obama"
+assert isinstance(root.get_right(), eldarcpp.WordNode)
+assert root.get_right().get_word() == "biden"
+
+query_tree = parse("a AND b")
+query_tree.expand([1], "c", "OR")
+assert query_tree.to_string() == "(a AND (b OR c))"
+assert isinstance(query_tree.get_root().get_right(), eldarcpp.OrNode)
+query_tree = parse("NOT a")
+query_tree.expand([0], "b", "AND NOT")
+assert query_tree.to_string() == "NOT (a AND NOT b)"
+assert isinstance(query_tree.get_root().get_child(), eldarcpp.AndNotNode)
+try:
+    parse("a").expand([0], "b")
+except RuntimeError:
+    pass
+else:
+    raise AssertionError("expanded below a word")
+
+# Every word is expanded with every operator, and the original is unchanged
+query_tree = parse("trump AND donald")
+expansions = [tree.to_string() for tree in query_tree.generate_all_expansions("kamala")]
+print("\nExpansions:", expansions)
+assert expansions == [
+    "((trump AND kamala) AND donald)",
+    "((trump OR kamala) AND donald)",
+    "((trump AND NOT kamala) AND donald)",
+    "(trump AND (donald AND kamala))",
+    "(trump AND (donald OR kamala))",
+    "(trump AND (donald AND NOT kamala))",
+]
+assert query_tree.to_string() == "(trump AND donald)"
+
+
+# Searches agree with sets computed by walking the tree
+def evaluate(node, documents):
+    everything = set(range(len(documents)))
+    if isinstance(node, eldarcpp.PatternNode):
+        return {i for i, words in enumerate(documents) if any(node.matches(w) for w in words)}
+    if isinstance(node, eldarcpp.WordNode):
+        return {i for i, words in enumerate(documents) if node.get_word() in words}
+    if isinstance(node, eldarcpp.NotNode):
+        return everything - evaluate(node.get_child(), documents)
+    left = evaluate(node.get_left(), documents)
+    right = evaluate(node.get_right(), documents)
+    if isinstance(node, eldarcpp.AndNode):
+        return left & right
+    if isinstance(node, eldarcpp.OrNode):
+        return left | right
+    assert isinstance(node, eldarcpp.AndNotNode)
+    return left - right
+
+
+rng = random.Random(0)
+vocabulary = ["trump", "donald", "kamala", "biden", "obama", "cat", "cot", "dog"]
+documents = [rng.sample(vocabulary, rng.randint(0, 4)) for _ in range(500)]
+index = eldarcpp.Index()
+index.add_documents(documents)
+
+queries = ["trump AND donald", "c*t OR NOT dog", "NOT (obama OR biden) AND NOT kamala", "d* AND NOT donald"]
+trees = [parse(query) for query in queries]
+trees += [tree for query in queries for tree in parse(query).generate_all_expansions("biden")]
+for tree in trees:
+    expected = sorted(evaluate(tree.get_root(), documents))
+    assert list(index.search(tree)) == expected, tree.to_string()
+    assert index.count(tree) == len(expected), tree.to_string()
+print(f"\n{len(trees)} searches checked")
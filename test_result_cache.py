@@ -0,0 +1,89 @@
+import os
+import tempfile
+
+import eldarcpp
+
+
+def make_documents(count, offset=0):
+    documents = []
+    for i in range(offset, offset + count):
+        words = [f"w{i % 50}"]
+        if i % 3 == 0:
+            words.append("president")
+        if i % 5 == 0:
+            words.append("obama")
+        if i % 7 == 0:
+            words.append("biden")
+        documents.append(words)
+    return documents
+
+
+def check(index, reference, query):
+    assert list(index.search(query)) == list(reference.search(query)), query
+    assert index.count(query) == reference.count(query), query
+
+
+shared = "(president OR obama OR biden)"
+documents = make_documents(2000)
+
+plain = eldarcpp.Index()
+plain.add_documents(documents)
+cached = eldarcpp.Index()
+cached.add_documents(documents)
+cached.set_result_cache_size(1 << 20)
+
+# A subtree is stored the second time a query evaluated in full misses it,
+# and found by every later query containing it, whatever its operand order
+cached.count(f"w1 AND {shared}")
+cached.count(f"w2 AND {shared}")
+stats = cached.get_result_cache_stats()
+print("After two queries:", stats)
+assert stats["entries"] == 1 and stats["hits"] == 0
+
+check(cached, plain, "w3 AND (biden OR president OR obama)")
+stats = cached.get_result_cache_stats()
+print("After a hit:", stats)
+assert stats["hits"] >= 1
+
+# Lazy queries reuse entries, but a miss they could not fill is not counted
+misses = stats["misses"]
+assert cached.exists(f"w4 AND {shared}") == plain.exists(f"w4 AND {shared}")
+assert list(cached.search_page("w5 AND (w6 OR w7)", 3)) == list(plain.search_page("w5 AND (w6 OR w7)", 3))
+assert cached.get_result_cache_stats()["misses"] == misses
+
+# Documents added after an entry was computed extend it
+more = make_documents(500, offset=2000)
+plain.add_documents(more)
+cached.add_documents(more)
+check(cached, plain, f"w8 AND {shared}")
+stats = cached.get_result_cache_stats()
+print("After ingest:", stats)
+assert stats["extensions"] == 1
+
+# Renumbering the documents drops every entry
+order = cached.reorder()
+assert cached.get_result_cache_stats()["entries"] == 0
+for query in [f"w9 AND {shared}", f"w9 AND {shared}", f"w10 AND {shared}"]:
+    assert sorted(order[doc] for doc in cached.search(query)) == list(plain.search(query)), query
+print("After reorder:", cached.get_result_cache_stats())
+
+# So do loading and mapping another index
+other = eldarcpp.Index()
+other.add_documents(make_documents(300, offset=7))
+path = os.path.join(tempfile.mkdtemp(), "other.idx")
+other.save(path)
+cached.count(f"w11 AND {shared}")
+assert cached.get_result_cache_stats()["entries"] > 0
+cached.load(path)
+assert cached.get_result_cache_stats()["entries"] == 0
+for query in [f"w12 AND {shared}", f"w12 AND {shared}", shared]:
+    check(cached, other, query)
+
+cached.count(f"w13 AND {shared}")
+cached.map(path)
+assert cached.get_result_cache_stats()["entries"] == 0
+for query in [f"w14 AND {shared}", f"w14 AND {shared}", shared]:
+    check(cached, other, query)
+os.remove(path)
+
+print("\nFinal stats:", cached.get_result_cache_stats())